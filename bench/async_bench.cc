@@ -0,0 +1,56 @@
+// 多生产者吞吐量：比较 AsyncLogging 加锁路径与线程暂存队列路径
+// 用法: async_bench [线程数] [每个线程的消息数]
+#include "asynclogging.h"
+#include "benchutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+static void run(bool staging, int threads, int messages)
+{
+    char line[128];
+    memset(line, 'x', sizeof(line));
+    line[sizeof(line) - 1] = '\n';
+
+    AsyncLogging async(500, 1024 * 1024 * 1024, staging);
+    int64_t start = nowNanos();
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t)
+    {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < messages; ++i)
+            {
+                async.append(line, sizeof(line));
+            }
+        });
+    }
+    for (auto &producer : producers)
+    {
+        producer.join();
+    }
+    int64_t front = nowNanos() - start;
+    async.stop();
+    int64_t total = nowNanos() - start;
+
+    double count = static_cast<double>(threads) * messages;
+    BenchResult("async_append", staging ? "staging" : "mutex")
+        .add("threads", threads)
+        .add("messages", count)
+        .add("front_msgs_per_sec", count * 1e9 / front)
+        .add("total_msgs_per_sec", count * 1e9 / total)
+        .add("ns_per_msg", static_cast<double>(front) / (count / threads))
+        .print();
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 32;
+    int messages = argc > 2 ? atoi(argv[2]) : 200000;
+    run(false, threads, messages);
+    run(true, threads, messages);
+    return 0;
+}
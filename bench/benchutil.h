@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// 单调时钟，纳秒
+inline int64_t nowNanos()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// 防止编译器把被测代码优化掉
+template <class T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * 一条基准测试结果，输出为一行 JSON
+ * {"bench":"...","name":"...","key":value,...}
+ */
+class BenchResult
+{
+public:
+    BenchResult(const char *bench, const std::string &name) : bench_(bench), name_(name) {}
+
+    BenchResult &add(const char *key, double value)
+    {
+        fields_.emplace_back(key, value);
+        return *this;
+    }
+
+    void print() const
+    {
+        printf("{\"bench\":\"%s\",\"name\":\"%s\"", bench_, name_.c_str());
+        for (const auto &field : fields_)
+        {
+            printf(",\"%s\":%.3f", field.first, field.second);
+        }
+        printf("}\n");
+        fflush(stdout);
+    }
+
+private:
+    const char *bench_;
+    std::string name_;
+    std::vector<std::pair<const char *, double>> fields_;
+};
@@ -0,0 +1,107 @@
+// 写入时压缩的效果：在限速的磁盘上比较不压缩和逐批 gzip 压缩的有效吞吐量
+// 磁盘限速通过休眠模拟：已经写入文件的字节数 / 带宽 大于已用时间时，休眠到相等为止
+// 用法: compress_bench [磁盘带宽MB/s] [批次数]
+#include "compressedlog.h"
+#include "logfile.h"
+#include "logger.h"
+#include "benchutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+
+// 当前日志文件的大小(通过指向它的符号链接)
+static off_t currentFileSize()
+{
+    char exe[PATH_MAX] = {0};
+    if (::readlink("/proc/self/exe", exe, sizeof(exe) - 1) <= 0)
+    {
+        return 0;
+    }
+    std::string link = std::string("log/") + (strrchr(exe, '/') + 1) + ".log";
+    struct stat st;
+    return ::stat(link.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    double bandwidth_mb = argc > 1 ? atof(argv[1]) : 50;
+    int batches = argc > 2 ? atoi(argv[2]) : 32;
+    double bandwidth = bandwidth_mb * 1024 * 1024;
+
+    // 用真实的日志行填满一个批次
+    static std::string batch;
+    batch.reserve(KLargeBuffer);
+    Logger::setOutputFunc([](const LogStream::Buffer &buf) { batch.append(buf.data(), buf.length()); });
+    size_t lines = 0;
+    while (batch.size() + kSmallBuffer < static_cast<size_t>(KLargeBuffer))
+    {
+        LOG_INFO << "order " << 100000 + lines * 7 << " filled qty " << lines % 500 << " price " << 3.14159 * (lines % 97)
+                 << " user " << (lines * 2654435761u) % 100000;
+        ++lines;
+    }
+    Logger::setOutputFunc([](const LogStream::Buffer &buf) {
+        fwrite(buf.data(), 1, static_cast<size_t>(buf.length()), stdout);
+    });
+
+    for (int compress = 0; compress < 2; ++compress)
+    {
+        LogFileOptions options;
+        options.inline_compress = compress != 0;
+        double file_bytes = 0;
+        int64_t elapsed = 0;
+        {
+            LogFile output(static_cast<off_t>(1) << 40, options);
+            int64_t start = nowNanos();
+            for (int i = 0; i < batches; ++i)
+            {
+                output.append(batch.data(), batch.size());
+                output.flush();
+                // 模拟限速的磁盘
+                file_bytes = static_cast<double>(currentFileSize());
+                int64_t disk_ns = static_cast<int64_t>(file_bytes / bandwidth * 1e9);
+                int64_t spent = nowNanos() - start;
+                if (disk_ns > spent)
+                {
+                    ::usleep(static_cast<useconds_t>((disk_ns - spent) / 1000));
+                }
+            }
+            elapsed = nowNanos() - start;
+        }
+
+        double raw_bytes = static_cast<double>(batch.size()) * batches;
+        BenchResult("compress", compress ? "inline_gzip" : "plain")
+            .add("disk_mb_per_sec", bandwidth_mb)
+            .add("raw_bytes", raw_bytes)
+            .add("file_bytes", file_bytes)
+            .add("ratio", raw_bytes / file_bytes)
+            .add("msgs_per_sec", static_cast<double>(lines) * batches * 1e9 / elapsed)
+            .print();
+    }
+
+    // 随机访问：按偏移找到一帧并解压
+    char exe[PATH_MAX] = {0};
+    if (::readlink("/proc/self/exe", exe, sizeof(exe) - 1) > 0)
+    {
+        char target[PATH_MAX] = {0};
+        std::string link = std::string("log/") + (strrchr(exe, '/') + 1) + ".log";
+        if (::readlink(link.c_str(), target, sizeof(target) - 1) > 0)
+        {
+            CompressedLogReader reader(target);
+            std::string frame;
+            int64_t start = nowNanos();
+            int index = reader.findByOffset(batch.size() * batches / 2);
+            bool ok = reader.readFrame(index, &frame);
+            int64_t elapsed = nowNanos() - start;
+            BenchResult("compress", "random_access")
+                .add("frames", static_cast<double>(reader.frames().size()))
+                .add("ok", ok && frame == batch)
+                .add("read_frame_us", elapsed / 1e3)
+                .print();
+        }
+    }
+    return 0;
+}
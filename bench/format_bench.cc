@@ -0,0 +1,202 @@
+// LogStream 格式化的微基准测试，以及编译期解析的格式串(LOG_FORMAT_TO)
+// 用法: format_bench [迭代次数]
+#include "logstream.h"
+#include "logformat.h"
+#include "benchutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+// 测量 fn 对 values 中每个值调用一次的平均耗时
+template <class T, class Fn>
+static void measure(const char *name, const std::vector<T> &values, int iterations, Fn fn)
+{
+    int64_t start = nowNanos();
+    for (int i = 0; i < iterations; ++i)
+    {
+        fn(values[i % values.size()]);
+    }
+    int64_t elapsed = nowNanos() - start;
+    BenchResult("format", name)
+        .add("iterations", iterations)
+        .add("ns_per_op", static_cast<double>(elapsed) / iterations)
+        .print();
+}
+
+static void benchDouble(int iterations)
+{
+    std::vector<double> values;
+    srand(1);
+    for (int i = 0; i < 4096; ++i)
+    {
+        values.push_back((rand() - RAND_MAX / 2) / 997.0);
+    }
+
+    LogStream stream;
+    char buf[64];
+    // 旧实现：snprintf("%.12g")
+    measure("double_snprintf", values, iterations, [&](double v) {
+        int len = snprintf(buf, sizeof(buf), "%.12g", v);
+        doNotOptimize(len);
+        doNotOptimize(buf);
+    });
+    measure("double_shortest", values, iterations, [&](double v) {
+        if (stream.buffer().avail() < 64)
+        {
+            stream.resetBuffer();
+        }
+        stream << v;
+    });
+    measure("double_fixed3", values, iterations, [&](double v) {
+        if (stream.buffer().avail() < 64)
+        {
+            stream.resetBuffer();
+        }
+        stream << LogStream::fixed(v, 3);
+    });
+}
+
+// 旧实现：逐位除法后反转，作为对照
+template <class T>
+static size_t convertReference(char buf[], T value)
+{
+    static const char digits[] = "9876543210123456789";
+    static const char *zero = digits + 9;
+    T i = value;
+    char *p = buf;
+    do
+    {
+        int lsd = static_cast<int>(i % 10);
+        i /= 10;
+        *p++ = zero[lsd];
+    } while (i != 0);
+    if (value < 0)
+    {
+        *p++ = '-';
+    }
+    std::reverse(buf, p);
+    return p - buf;
+}
+
+template <class T>
+static void benchIntegers(const char *name, const std::vector<T> &values, int iterations)
+{
+    LogStream stream;
+    char buf[32];
+    std::string reference = std::string(name) + "_reference";
+    measure(reference.c_str(), values, iterations, [&](T v) {
+        size_t len = convertReference(buf, v);
+        doNotOptimize(len);
+        doNotOptimize(buf);
+    });
+    measure(name, values, iterations, [&](T v) {
+        if (stream.buffer().avail() < 64)
+        {
+            stream.resetBuffer();
+        }
+        stream << v;
+    });
+}
+
+static void benchInteger(int iterations)
+{
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> uniform64;
+    std::vector<int> uniform32;
+    std::vector<int> small;
+    for (int i = 0; i < 4096; ++i)
+    {
+        uniform64.push_back(rng());
+        uniform32.push_back(static_cast<int>(rng()));
+        small.push_back(static_cast<int>(rng() % 100));
+    }
+    benchIntegers("uint64_uniform", uniform64, iterations);
+    benchIntegers("int32_uniform", uniform32, iterations);
+    benchIntegers("int32_small", small, iterations);
+
+    LogStream stream;
+    measure("int32_zero_pad8", uniform32, iterations, [&](int v) {
+        if (stream.buffer().avail() < 64)
+        {
+            stream.resetBuffer();
+        }
+        stream << LogStream::zeroPad(v, 8);
+    });
+    measure("uint64_hex", uniform64, iterations, [&](uint64_t v) {
+        if (stream.buffer().avail() < 64)
+        {
+            stream.resetBuffer();
+        }
+        stream << LogStream::hex(v);
+    });
+}
+
+// 每个 operator<< 的耗时
+static void benchOperators(int iterations)
+{
+    LogStream stream;
+    std::vector<int> index(64);
+    std::string str("a std::string argument");
+    int value = 0;
+    auto run = [&](const char *name, auto fn) {
+        measure(name, index, iterations, [&](int) {
+            if (stream.buffer().avail() < 64)
+            {
+                stream.resetBuffer();
+            }
+            fn();
+        });
+    };
+    run("op_bool", [&]() { stream << ((++value & 1) != 0); });
+    run("op_char", [&]() { stream << 'c'; });
+    run("op_short", [&]() { stream << static_cast<short>(++value); });
+    run("op_int", [&]() { stream << ++value; });
+    run("op_long", [&]() { stream << static_cast<long>(++value) * 1000003L; });
+    run("op_unsigned_long_long", [&]() { stream << static_cast<unsigned long long>(++value) * 1000003ULL; });
+    run("op_float", [&]() { stream << static_cast<float>(++value) / 7.0f; });
+    run("op_double", [&]() { stream << static_cast<double>(++value) / 7.0; });
+    run("op_pointer", [&]() { stream << static_cast<const void *>(&value); });
+    run("op_cstring", [&]() { stream << "a C string argument"; });
+    run("op_string", [&]() { stream << str; });
+}
+
+// 同一条消息：连续的 operator<< 和编译期解析的格式串
+static void benchPattern(int iterations)
+{
+    LogStream stream;
+    std::vector<int> ids(4096);
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        ids[i] = static_cast<int>(i * 7919);
+    }
+    double price = 101.25;
+    measure("message_operators", ids, iterations, [&](int id) {
+        if (stream.buffer().avail() < 256)
+        {
+            stream.resetBuffer();
+        }
+        stream << "order " << id << " filled at " << price << " qty " << 300 << " side " << 'B';
+    });
+    measure("message_pattern", ids, iterations, [&](int id) {
+        if (stream.buffer().avail() < 256)
+        {
+            stream.resetBuffer();
+        }
+        LOG_FORMAT_TO(stream, "order {} filled at {} qty {} side {}", id, price, 300, 'B');
+    });
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 5000000;
+    benchOperators(iterations);
+    benchInteger(iterations);
+    benchDouble(iterations);
+    benchPattern(iterations);
+    return 0;
+}
@@ -0,0 +1,129 @@
+// LogFile 持续写入磁盘的吞吐量
+// 与日志线程的用法相同：每次写入一个大缓冲区，然后 flush
+// mmap 模式预先分配 1GB 的文件空间，退出时截断到实际长度
+// logfile_roll 比较滚动文件时单次写入的耗时，开启 preopen 后滚动只是交换指针
+// uring 模式下同时提交多个大缓冲区，写完后才重新使用
+// 用法: logfile_bench [写入的MB数] [每行字节数]
+#include "logfile.h"
+#include "logstream.h"
+#include "benchutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+int main(int argc, char *argv[])
+{
+    int total_mb = argc > 1 ? atoi(argv[1]) : 256;
+    int line_size = argc > 2 ? atoi(argv[2]) : 128;
+
+    // 用一行行的日志填满一个大缓冲区
+    std::vector<char> chunk(KLargeBuffer);
+    size_t lines_per_chunk = chunk.size() / line_size;
+    size_t chunk_size = lines_per_chunk * line_size;
+    memset(chunk.data(), 'x', chunk.size());
+    for (size_t i = 1; i <= lines_per_chunk; ++i)
+    {
+        chunk[i * line_size - 1] = '\n';
+    }
+
+    size_t total_bytes = static_cast<size_t>(total_mb) * 1024 * 1024;
+    size_t chunks = (total_bytes + chunk_size - 1) / chunk_size;
+    double bytes = static_cast<double>(chunks * chunk_size);
+    // stdio 和 mmap 两种同步写入方式
+    const FileBackend backends[] = {FileBackend::kStdio, FileBackend::kMmap};
+    const char *names[] = {"stdio", "mmap"};
+    for (int b = 0; b < 2; ++b)
+    {
+        LogFileOptions options;
+        options.backend = backends[b];
+        LogFile output(1024 * 1024 * 1024, options);
+        int64_t start = nowNanos();
+        for (size_t i = 0; i < chunks; ++i)
+        {
+            output.append(chunk.data(), chunk_size);
+            output.flush();
+        }
+        int64_t elapsed = nowNanos() - start;
+
+        BenchResult("logfile", names[b])
+            .add("bytes", bytes)
+            .add("line_size", line_size)
+            .add("mb_per_sec", bytes / (1024 * 1024) * 1e9 / elapsed)
+            .add("msgs_per_sec", static_cast<double>(chunks * lines_per_chunk) * 1e9 / elapsed)
+            .print();
+    }
+    {
+        // 与日志线程一样轮流使用多个缓冲区：写完的缓冲区才能再次提交
+        const size_t kBuffers = 8;
+        std::vector<std::vector<char>> buffers(kBuffers, chunk);
+        std::vector<void *> free_buffers;
+        for (auto &buffer : buffers)
+        {
+            free_buffers.push_back(buffer.data());
+        }
+
+        LogFileOptions options;
+        options.backend = FileBackend::kUring;
+        LogFile output(1024 * 1024 * 1024, options);
+        int64_t start = nowNanos();
+        for (size_t i = 0; i < chunks; ++i)
+        {
+            while (free_buffers.empty())
+            {
+                output.takeCompleted(free_buffers, true);
+            }
+            char *data = static_cast<char *>(free_buffers.back());
+            free_buffers.pop_back();
+            output.submit(data, chunk_size, data);
+            output.flush();
+        }
+        output.takeCompleted(free_buffers, true);
+        int64_t elapsed = nowNanos() - start;
+
+        BenchResult("logfile", "uring")
+            .add("bytes", bytes)
+            .add("line_size", line_size)
+            .add("mb_per_sec", bytes / (1024 * 1024) * 1e9 / elapsed)
+            .add("msgs_per_sec", static_cast<double>(chunks * lines_per_chunk) * 1e9 / elapsed)
+            .print();
+    }
+    {
+        // 滚动时的停顿：每个文件只写两个大缓冲区，比较每次写入的最大耗时
+        const off_t kRollSize = 2 * static_cast<off_t>(chunk_size) - 1;
+        const FileBackend roll_backends[] = {FileBackend::kStdio, FileBackend::kMmap};
+        const char *roll_names[] = {"stdio", "mmap"};
+        for (int b = 0; b < 2; ++b)
+        {
+            for (int preopen = 0; preopen < 2; ++preopen)
+            {
+                LogFileOptions options;
+                options.backend = roll_backends[b];
+                options.preopen = preopen != 0;
+                std::vector<int64_t> latencies;
+                latencies.reserve(chunks);
+                {
+                    LogFile output(kRollSize, options);
+                    for (size_t i = 0; i < chunks; ++i)
+                    {
+                        int64_t start = nowNanos();
+                        output.append(chunk.data(), chunk_size);
+                        output.flush();
+                        latencies.push_back(nowNanos() - start);
+                    }
+                }
+                std::sort(latencies.begin(), latencies.end());
+                BenchResult("logfile_roll", std::string(roll_names[b]) + (preopen ? "_preopen" : ""))
+                    .add("writes", static_cast<double>(latencies.size()))
+                    .add("p50_us", latencies[latencies.size() / 2] / 1e3)
+                    .add("p99_us", latencies[latencies.size() * 99 / 100] / 1e3)
+                    .add("max_us", latencies.back() / 1e3)
+                    .print();
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,197 @@
+// LOG_INFO 端到端基准测试：吞吐量和单次调用延迟的分位数
+// 分别测试同步日志(输出到 /dev/null)、异步日志和带线程暂存队列的异步日志，被限流跳过的调用的开销，
+// 结构化格式(JSON/logfmt)的开销，以及超出栈上缓冲区的大消息的开销
+// 用法: logger_bench [线程数] [每个线程的消息数]
+#include "logger.h"
+#include "benchutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum Mode
+{
+    kSync,
+    kAsync,
+    kAsyncStaging,
+};
+
+static const char *kModeNames[] = {"sync", "async", "async_staging"};
+static FILE *g_null_file = nullptr;
+
+// 切换日志模式，异步模式返回后端对象
+static std::unique_ptr<AsyncLogging> setMode(Mode mode)
+{
+    Logger::setOutputFunc([](const LogStream::Buffer &buf) {
+        fwrite(buf.data(), 1, static_cast<size_t>(buf.length()), g_null_file);
+    });
+    if (mode == kSync)
+    {
+        return nullptr;
+    }
+    std::unique_ptr<AsyncLogging> async(new AsyncLogging(500, 1024 * 1024 * 1024, mode == kAsyncStaging));
+    AsyncLogging *ptr = async.get();
+    Logger::setOutputFunc([ptr](const LogStream::Buffer &buf) { ptr->append(buf.data(), buf.length()); });
+    Logger::setAsync(ptr);
+    return async;
+}
+
+static void throughput(Mode mode, int threads, int messages)
+{
+    std::unique_ptr<AsyncLogging> async = setMode(mode);
+    int64_t start = nowNanos();
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t)
+    {
+        producers.emplace_back([messages]() {
+            for (int i = 0; i < messages; ++i)
+            {
+                LOG_INFO << "benchmark message " << i << ' ' << 3.14159 << " end";
+            }
+        });
+    }
+    for (auto &producer : producers)
+    {
+        producer.join();
+    }
+    int64_t front = nowNanos() - start;
+    if (async)
+    {
+        async->stop();
+    }
+    int64_t total = nowNanos() - start;
+
+    double count = static_cast<double>(threads) * messages;
+    BenchResult("logger_throughput", kModeNames[mode])
+        .add("threads", threads)
+        .add("messages", count)
+        .add("front_msgs_per_sec", count * 1e9 / front)
+        .add("total_msgs_per_sec", count * 1e9 / total)
+        .print();
+}
+
+static void latency(Mode mode, int messages)
+{
+    std::unique_ptr<AsyncLogging> async = setMode(mode);
+    std::vector<int64_t> samples;
+    samples.reserve(messages);
+    for (int i = 0; i < messages; ++i)
+    {
+        int64_t start = nowNanos();
+        LOG_INFO << "benchmark message " << i << ' ' << 3.14159 << " end";
+        samples.push_back(nowNanos() - start);
+    }
+    if (async)
+    {
+        async->stop();
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        size_t index = static_cast<size_t>(p * (samples.size() - 1));
+        return static_cast<double>(samples[index]);
+    };
+    BenchResult("logger_latency_ns", kModeNames[mode])
+        .add("messages", messages)
+        .add("p50", percentile(0.5))
+        .add("p99", percentile(0.99))
+        .add("p999", percentile(0.999))
+        .add("max", static_cast<double>(samples.back()))
+        .print();
+}
+
+// 被限流跳过的调用的开销(同步模式，几乎所有调用都被跳过)
+static void suppressed(int messages)
+{
+    setMode(kSync);
+    auto run = [messages](const char *name, void (*body)(int)) {
+        int64_t start = nowNanos();
+        for (int i = 0; i < messages; ++i)
+        {
+            body(i);
+        }
+        int64_t elapsed = nowNanos() - start;
+        BenchResult("logger_suppressed", name).add("ns_per_call", static_cast<double>(elapsed) / messages).print();
+    };
+    run("disabled_debug", [](int i) { LOG_DEBUG << "debug " << i; });
+    run("every_n_1000", [](int i) { LOG_EVERY_N(INFO, 1000) << "every n " << i; });
+    run("first_n_10", [](int i) { LOG_FIRST_N(INFO, 10) << "first n " << i; });
+    run("every_t_1000ms", [](int i) { LOG_EVERY_T(INFO, 1000) << "every t " << i; });
+    run("sampled_0.001", [](int i) { LOG_SAMPLED(INFO, 0.001) << "sampled " << i; });
+}
+
+// 同一条带字段的日志在文本、JSON 和 logfmt 格式下的耗时(同步模式，输出到 /dev/null)
+static void structured(int messages)
+{
+    setMode(kSync);
+    const LogStream::RecordFormat formats[] = {LogStream::kText, LogStream::kJson, LogStream::kLogfmt};
+    const char *names[] = {"text", "json", "logfmt"};
+    for (int f = 0; f < 3; ++f)
+    {
+        Logger::setRecordFormat(formats[f]);
+        int64_t start = nowNanos();
+        for (int i = 0; i < messages; ++i)
+        {
+            LOG_KV(INFO, "order filled").kv("order_id", i).kv("latency_us", 12.5).kv("venue", "XNAS");
+        }
+        int64_t elapsed = nowNanos() - start;
+        BenchResult("logger_structured", names[f])
+            .add("messages", messages)
+            .add("ns_per_msg", static_cast<double>(elapsed) / messages)
+            .print();
+    }
+    Logger::setRecordFormat(LogStream::kText);
+}
+
+// 不同长度的消息的耗时(异步+暂存队列)：超过 kSmallBuffer 的消息换到线程缓存的内存块中，
+// 超过暂存队列一半的消息分段写入异步日志的缓冲区
+static void large(int messages)
+{
+    for (int size : {64, 16 * 1024, 256 * 1024, 8 * 1024 * 1024})
+    {
+        std::unique_ptr<AsyncLogging> async = setMode(kAsyncStaging);
+        Logger::setMaxMessageSize(16 * 1024 * 1024);
+        std::string payload(static_cast<size_t>(size), 'x');
+        int count = std::max(messages / (size / 64), 16);
+        int64_t start = nowNanos();
+        for (int i = 0; i < count; ++i)
+        {
+            LOG_INFO << payload << ' ' << i;
+        }
+        int64_t elapsed = nowNanos() - start;
+        async->stop();
+        BenchResult("logger_large", std::to_string(size))
+            .add("messages", count)
+            .add("ns_per_msg", static_cast<double>(elapsed) / count)
+            .add("mb_per_sec", static_cast<double>(size) * count * 1e3 / elapsed)
+            .print();
+    }
+    Logger::setMaxMessageSize(1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int messages = argc > 2 ? atoi(argv[2]) : 200000;
+    g_null_file = fopen("/dev/null", "w");
+
+    for (Mode mode : {kSync, kAsync, kAsyncStaging})
+    {
+        throughput(mode, 1, messages);
+        throughput(mode, threads, messages);
+        latency(mode, messages);
+    }
+    suppressed(messages * 10);
+    structured(messages);
+    large(messages);
+    Logger::setOutputFunc([](const LogStream::Buffer &buf) {
+        fwrite(buf.data(), 1, static_cast<size_t>(buf.length()), stdout);
+    });
+    fclose(g_null_file);
+    return 0;
+}
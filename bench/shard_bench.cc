@@ -0,0 +1,60 @@
+// 分片异步日志的多生产者吞吐量：比较 1/2/4 个分片
+// 每个分片有自己的日志线程，只有在多核机器上才能看到吞吐量随分片数增长
+// 用法: shard_bench [线程数] [每个线程的消息数]
+#include "shardedlogging.h"
+#include "benchutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+static void run(int shards, int threads, int messages)
+{
+    char line[128];
+    memset(line, 'x', sizeof(line));
+    line[sizeof(line) - 1] = '\n';
+
+    ShardedAsyncLogging sharded(shards, ShardMapping::kThreadId, 500, 1024 * 1024 * 1024);
+    int64_t start = nowNanos();
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t)
+    {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < messages; ++i)
+            {
+                sharded.append(line, sizeof(line));
+            }
+        });
+    }
+    for (auto &producer : producers)
+    {
+        producer.join();
+    }
+    int64_t front = nowNanos() - start;
+    sharded.stop();
+    int64_t total = nowNanos() - start;
+
+    double count = static_cast<double>(threads) * messages;
+    BenchResult("sharded_append", "shards" + std::to_string(shards))
+        .add("shards", shards)
+        .add("threads", threads)
+        .add("messages", count)
+        .add("front_msgs_per_sec", count * 1e9 / front)
+        .add("total_msgs_per_sec", count * 1e9 / total)
+        .add("dropped", static_cast<double>(sharded.metrics().dropped.messages[2]))
+        .print();
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int messages = argc > 2 ? atoi(argv[2]) : 200000;
+    for (int shards = 1; shards <= 4; shards *= 2)
+    {
+        run(shards, threads, messages);
+    }
+    return 0;
+}
@@ -1,70 +1,656 @@
 #include "asynclogging.h"
 #include "logfile.h"
+#include "logger.h"
+#include "timestamp.h"
+#include "currentthread.h"
+#include "deferredlog.h"
 
 #include <iostream>
 #include <unistd.h>
+#include <pthread.h>
 #include <memory>
 #include <stdio.h>
 #include <functional>
+#include <algorithm>
 
-AsyncLogging::AsyncLogging(int flush_interval, int roll_size)
+namespace
+{
+// 单一写者的计数器：不需要原子的读-改-写指令
+inline void bump(std::atomic<uint64_t> &counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// 每个 AsyncLogging 实例的编号
+std::atomic<uint64_t> g_next_id(1);
+
+// crash_safe 模式下文件映射区域的槽位数，用完后缓冲区退回匿名内存
+const int kArenaSlots = 8;
+
+// 线程局部：当前线程的暂存队列
+struct LocalRing
+{
+    uint64_t owner = 0; // 所属 AsyncLogging 实例的编号
+    std::shared_ptr<StagingRing> ring;
+    // 线程退出时关闭队列，日志线程读完后回收
+    ~LocalRing()
+    {
+        if (ring)
+        {
+            ring->close();
+        }
+    }
+};
+thread_local LocalRing t_local_ring;
+} // namespace
+
+AsyncLogging::AsyncLogging(int flush_interval, int roll_size, bool staging, const LogFileOptions &file_options)
     : flush_interval_(flush_interval),
       roll_size_(roll_size),
+      staging_(staging),
+      file_options_(file_options),
+      id_(g_next_id++),
       running_(true),
-      thread_(std::bind(AsyncLogging::writeThread, this), "AsyncLoggingThread"),
-      current_buffer_(new Buffer),
-      next_buffer_(new Buffer),
-      buffers_()
+      policy_(OverflowPolicy::kDropNewest),
+      queue_limit_bytes_(16 * static_cast<size_t>(KLargeBuffer)),
+      spill_limit_bytes_(queue_limit_bytes_),
+      block_timeout_ms_(100),
+      min_kept_level_(3),
+      queued_bytes_(0),
+      dropped_messages_(), // 值初始化：日志线程启动之前全部清零
+      dropped_bytes_(),
+      counters_(),
+      metrics_interval_(0),
+      arena_(),
+      pool_(4, 16, BufferPoolOptions::kPrefault, createArena(file_options)),
+      current_buffer_(pool_.acquire()),
+      next_buffer_(pool_.acquire()),
+      buffers_(),
+      thread_(&AsyncLogging::writeThread, this)
 {
-    current_buffer_->bzero();
-    next_buffer_->bzero();
     buffers_.reserve(8);
 }
 
+BufferArena *AsyncLogging::createArena(const LogFileOptions &file_options)
+{
+    std::string dir;
+    std::string prefix;
+    if (!file_options.crash_safe || !LogFile::basePath(file_options, &dir, &prefix))
+    {
+        return nullptr;
+    }
+    arena_.reset(new BufferArena(dir + prefix + ".buf", BufferPool<Buffer>::mappedSize(), kArenaSlots));
+    if (!arena_->ok())
+    {
+        // 例如同名的日志正在被另一个进程使用：退回匿名内存
+        arena_.reset();
+    }
+    return arena_.get();
+}
+
+void AsyncLogging::setBufferPool(size_t min_count, size_t max_count, int flags)
+{
+    pool_.configure(min_count, max_count, flags);
+}
+
+void AsyncLogging::setOverflowPolicy(OverflowPolicy policy, size_t queue_limit_bytes,
+                                     int block_timeout_ms, int min_kept_level)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    policy_ = policy;
+    queue_limit_bytes_ = queue_limit_bytes;
+    spill_limit_bytes_.store(queue_limit_bytes, std::memory_order_relaxed);
+    block_timeout_ms_ = block_timeout_ms;
+    min_kept_level_ = min_kept_level;
+}
+
+LevelCounts AsyncLogging::droppedCounts() const
+{
+    LevelCounts counts;
+    for (int i = 0; i < kNumLogLevels; ++i)
+    {
+        counts.messages[i] = dropped_messages_[i].load(std::memory_order_relaxed);
+        counts.bytes[i] = dropped_bytes_[i].load(std::memory_order_relaxed);
+    }
+    return counts;
+}
+
+AsyncLoggingMetrics AsyncLogging::metrics() const
+{
+    AsyncLoggingMetrics metrics;
+    for (int i = 0; i < kNumLogLevels; ++i)
+    {
+        metrics.accepted.messages[i] = counters_.accepted_messages[i].load(std::memory_order_relaxed);
+        metrics.accepted.bytes[i] = counters_.accepted_bytes[i].load(std::memory_order_relaxed);
+    }
+    metrics.dropped = droppedCounts();
+    metrics.buffers_swapped = counters_.buffers_swapped.load(std::memory_order_relaxed);
+    metrics.queue_high_water = counters_.queue_high_water.load(std::memory_order_relaxed);
+    metrics.batches = counters_.batches.load(std::memory_order_relaxed);
+    metrics.append_ns = counters_.append_ns.load(std::memory_order_relaxed);
+    metrics.flush_ns = counters_.flush_ns.load(std::memory_order_relaxed);
+    metrics.file_rolls = counters_.file_rolls.load(std::memory_order_relaxed);
+    metrics.write_errors = counters_.write_errors.load(std::memory_order_relaxed);
+    for (int i = 0; i < AsyncLoggingMetrics::kLatencyBuckets; ++i)
+    {
+        metrics.batch_latency[i] = counters_.batch_latency[i].load(std::memory_order_relaxed);
+    }
+    return metrics;
+}
+
+void AsyncLogging::countAccepted(const LevelCounts &counts)
+{
+    for (int i = 0; i < kNumLogLevels; ++i)
+    {
+        if (counts.messages[i] > 0)
+        {
+            bump(counters_.accepted_messages[i], counts.messages[i]);
+            bump(counters_.accepted_bytes[i], counts.bytes[i]);
+        }
+    }
+}
+
+void AsyncLogging::writeOutput(LogFile &output, const char *data, size_t len)
+{
+    int64_t start = Timestamp::monotonicNanos();
+    output.append(data, len);
+    bump(counters_.append_ns, static_cast<uint64_t>(Timestamp::monotonicNanos() - start));
+}
+
+void AsyncLogging::countDropped(int level, uint64_t messages, uint64_t bytes)
+{
+    dropped_messages_[level].fetch_add(messages, std::memory_order_relaxed);
+    dropped_bytes_[level].fetch_add(bytes, std::memory_order_relaxed);
+}
+
 // 所有的LOG_ 最终都会调用 AsyncLogging::append
-void AsyncLogging::append(const char *buf, int len)
+void AsyncLogging::append(const char *buf, int len, int level)
 {
+    if (staging_)
+    {
+        char *dest = reserve(len);
+        if (dest)
+        {
+            memcpy(dest, buf, len);
+            commit(len, Timestamp::now(), StagingRing::kText, level);
+            return;
+        }
+        if (level < 0 || level >= kNumLogLevels)
+        {
+            level = kNumLogLevels - 1;
+        }
+        // 日志线程已经停止：不会再有人读取暂存队列和溢出区
+        if (!running_)
+        {
+            countDropped(level, 1, static_cast<uint64_t>(len));
+            return;
+        }
+        // 暂存队列已满：写入这个线程的溢出区，日志线程读完队列之后再读它，不会打乱同一线程的顺序
+        // (加锁的缓冲区在暂存队列之前写入文件，不能用于开启暂存队列的线程)。溢出区同样以队列上限为限
+        size_t limit = spill_limit_bytes_.load(std::memory_order_relaxed);
+        if (localRing()->spill(buf, len, Timestamp::now(), StagingRing::kText, level, limit))
+        {
+            cond_.notify_one();
+        }
+        else
+        {
+            countDropped(level, 1, static_cast<uint64_t>(len));
+        }
+        return;
+    }
+    appendLocked(buf, len, level);
+}
+
+char *AsyncLogging::reserve(int len)
+{
+    if (!staging_ || !running_)
+    {
+        return nullptr;
+    }
+    return localRing()->reserve(len);
+}
+
+void AsyncLogging::cancel()
+{
+    t_local_ring.ring->cancel();
+}
+
+void AsyncLogging::commit(int len, int64_t time, uint32_t kind, int level)
+{
+    StagingRing *ring = t_local_ring.ring.get();
+    ring->commit(len, time, kind, level);
+    // 暂存队列超过一半时提醒日志线程，不加锁，最坏情况下日志线程等到超时
+    if (ring->used() > kStagingRingSize / 2)
+    {
+        cond_.notify_one();
+    }
+}
+
+void AsyncLogging::appendLocked(const char *buf, int len, int level)
+{
+    if (level < 0 || level >= kNumLogLevels)
+    {
+        level = kNumLogLevels - 1;
+    }
     // 加锁
     std::unique_lock<std::mutex> guard(mutex_);
+    // 日志线程退出前已经取走了当前缓冲区：之后的日志计入丢弃
+    if (!current_buffer_)
+    {
+        countDropped(level, 1, static_cast<uint64_t>(len));
+        return;
+    }
     // 如果当前Buffer还有空间，就添加到当前日志
-    if (current_buffer_->avail())
+    if (current_buffer_->avail() > len)
     {
-        current_buffer_->append(buf, len);
+        current_buffer_->append(buf, len, level);
     }
     else // 如果当前Buffer已满，需要通知日志线程有数据可写
     {
-        // 把当前Buffer 添加到队列中
-        buffers_.push_back(std::move(current_buffer_));
-        // 将下一个Buffer 设置为当前 Buffer
-        if (next_buffer_)
+        // 比整个缓冲区还大的消息分段写入，所有分段都会进入队列，按整条消息检查上限，
+        // 要么整条写入，要么整条丢弃，不会只写入一部分
+        size_t pending = len >= KLargeBuffer ? static_cast<size_t>(len) : 0;
+        // 队列超过上限时按策略处理
+        if (queued_bytes_ + current_buffer_->length() + pending > queue_limit_bytes_ &&
+            !handleOverflow(guard, len, level, pending))
         {
-            current_buffer_ = std::move(next_buffer_);
+            return;
         }
-        else
+        if (current_buffer_->avail() > len)
+        {
+            // kBlock 等待期间日志线程已经换上了新的缓冲区
+            current_buffer_->append(buf, len, level);
+            return;
+        }
+        rotateLocked();
+        // 比整个缓冲区还大的消息分段写满连续的缓冲区，持有锁期间不会与其他消息交错；只在最后一段计数
+        while (current_buffer_->avail() <= len)
         {
-            // 如果写入速度太快，两个缓冲区都满了，那么分配一块新的Buffer
-            current_buffer_.reset(new Buffer); // 极少发生
+            int chunk = current_buffer_->avail() - 1;
+            current_buffer_->append(buf, chunk, level, 0);
+            buf += chunk;
+            len -= chunk;
+            rotateLocked();
         }
         // 更换完Buffer 后，再将数据写入
-        current_buffer_->append(buf, len);
+        current_buffer_->append(buf, len, level);
         // 通知日志线程，有数据可写(只有当缓冲区满了才将日志写入文件)
         cond_.notify_one();
     }
 }
 
+void AsyncLogging::rotateLocked()
+{
+    // 把当前Buffer 添加到队列中
+    queued_bytes_ += current_buffer_->length();
+    if (queued_bytes_ > counters_.queue_high_water.load(std::memory_order_relaxed))
+    {
+        counters_.queue_high_water.store(queued_bytes_, std::memory_order_relaxed);
+    }
+    buffers_.push_back(std::move(current_buffer_));
+    // 将下一个Buffer 设置为当前 Buffer
+    if (next_buffer_)
+    {
+        current_buffer_ = std::move(next_buffer_);
+    }
+    else
+    {
+        // 如果写入速度太快，两个缓冲区都满了，那么分配一块新的Buffer
+        current_buffer_ = pool_.acquire(); // 极少发生，优先从缓冲池中取
+    }
+}
+
+bool AsyncLogging::handleOverflow(std::unique_lock<std::mutex> &guard, int len, int level, size_t pending)
+{
+    // 写入这条消息之后队列的长度
+    auto queued = [this, pending]() { return queued_bytes_ + current_buffer_->length() + pending; };
+    switch (policy_)
+    {
+    case OverflowPolicy::kBlock:
+    {
+        // 唤醒日志线程并等待它取走队列
+        cond_.notify_one();
+        bool ready = not_full_.wait_for(guard, std::chrono::milliseconds(block_timeout_ms_), [this, &queued]() {
+            return !running_ || queued() <= queue_limit_bytes_;
+        });
+        if (ready && running_)
+        {
+            return true;
+        }
+        break;
+    }
+    case OverflowPolicy::kDropNewest:
+        break;
+    case OverflowPolicy::kDropOldest:
+        // 丢弃最旧的缓冲区，统计其中每个级别的消息
+        while (!buffers_.empty() && queued() > queue_limit_bytes_)
+        {
+            const LevelCounts &counts = buffers_.front()->counts();
+            for (int i = 0; i < kNumLogLevels; ++i)
+            {
+                if (counts.messages[i] > 0)
+                {
+                    countDropped(i, counts.messages[i], counts.bytes[i]);
+                }
+            }
+            queued_bytes_ -= buffers_.front()->length();
+            // 被丢弃的缓冲区留作预备缓冲区，或者归还缓冲池
+            buffers_.front()->reset();
+            if (!next_buffer_)
+            {
+                next_buffer_ = std::move(buffers_.front());
+            }
+            else
+            {
+                pool_.release(std::move(buffers_.front()));
+            }
+            buffers_.erase(buffers_.begin());
+        }
+        return true;
+    case OverflowPolicy::kDropByLevel:
+        // 高级别的消息最多允许队列达到上限的两倍
+        if (level >= min_kept_level_ && queued() <= 2 * queue_limit_bytes_)
+        {
+            return true;
+        }
+        break;
+    }
+    countDropped(level, 1, static_cast<uint64_t>(len));
+    return false;
+}
+
+StagingRing *AsyncLogging::localRing()
+{
+    LocalRing &local = t_local_ring;
+    if (local.owner != id_)
+    {
+        // 第一次使用：创建暂存队列并注册到日志线程
+        if (local.ring)
+        {
+            local.ring->close();
+        }
+        local.ring = std::make_shared<StagingRing>();
+        local.owner = id_;
+        std::unique_lock<std::mutex> guard(rings_mutex_);
+        rings_.push_back(local.ring);
+    }
+    return local.ring.get();
+}
+
+void AsyncLogging::drainStaging(LogFile &output, Buffer &merge_buffer)
+{
+    // 读取位置：先读队列中 [pos, end) 的记录，再读溢出区中 [spill, spill_end) 的记录
+    struct Cursor
+    {
+        StagingRing *ring;
+        uint64_t pos;
+        uint64_t end;
+        const char *spill;
+        const char *spill_end;
+        const StagingRing::RecordHeader *record;
+
+        // 读取当前位置的记录，读完时返回 false
+        bool load()
+        {
+            if (pos != end)
+            {
+                record = ring->record(pos);
+                return true;
+            }
+            if (spill != spill_end)
+            {
+                record = reinterpret_cast<const StagingRing::RecordHeader *>(spill);
+                return true;
+            }
+            return false;
+        }
+        // 移到下一条记录
+        void advance()
+        {
+            if (pos != end)
+            {
+                pos = StagingRing::next(pos, record);
+            }
+            else
+            {
+                spill += StagingRing::next(0, record);
+            }
+        }
+    };
+    // 小顶堆：时间戳最小的记录在堆顶
+    auto later = [](const Cursor &a, const Cursor &b) { return a.record->time > b.record->time; };
+
+    std::vector<RingPtr> rings;
+    {
+        std::unique_lock<std::mutex> guard(rings_mutex_);
+        rings = rings_;
+    }
+
+    std::vector<Cursor> heap;
+    std::vector<std::pair<StagingRing *, uint64_t>> ends;
+    std::vector<std::vector<char>> spills(rings.size()); // 取出的溢出区
+    heap.reserve(rings.size());
+    ends.reserve(rings.size());
+    for (size_t i = 0; i < rings.size(); ++i)
+    {
+        StagingRing *ring = rings[i].get();
+        // 只读取本轮开始时已经发布的记录，以及与之同时取出的溢出区
+        uint64_t pos = ring->head();
+        uint64_t end = ring->spilled() ? ring->takeSpill(spills[i]) : ring->tail();
+        if (pos == end && spills[i].empty())
+        {
+            continue;
+        }
+        ends.emplace_back(ring, end);
+        Cursor cursor{ring, pos, end, spills[i].data(), spills[i].data() + spills[i].size(), nullptr};
+        if (cursor.load())
+        {
+            heap.push_back(cursor);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+    // 本轮收集的每个级别的消息数
+    LevelCounts accepted;
+    memset(&accepted, 0, sizeof(accepted));
+
+    // 多路归并：恢复多个线程之间的时间顺序
+    while (!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Cursor &cursor = heap.back();
+        const char *data = reinterpret_cast<const char *>(cursor.record + 1);
+        int len = static_cast<int>(cursor.record->len);
+        if (cursor.record->kind == StagingRing::kDeferred)
+        {
+            // 延迟日志在这里才真正格式化，超出栈上缓冲区时与 Logger 一样扩展
+            char storage[kSmallBuffer];
+            LogStream stream(storage, kSmallBuffer);
+            formatDeferredRecord(data, len, cursor.record->time, stream);
+            len = stream.buffer().length();
+            appendMerged(output, merge_buffer, stream.buffer().data(), len);
+        }
+        else
+        {
+            appendMerged(output, merge_buffer, data, len);
+        }
+        int level = std::min<int>(cursor.record->level, kNumLogLevels - 1);
+        ++accepted.messages[level];
+        accepted.bytes[level] += len;
+
+        cursor.advance();
+        if (!cursor.load())
+        {
+            heap.pop_back();
+        }
+        else
+        {
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    if (merge_buffer.length() > 0)
+    {
+        writeOutput(output, merge_buffer.data(), static_cast<size_t>(merge_buffer.length()));
+        merge_buffer.reset();
+    }
+    countAccepted(accepted);
+
+    // 数据已经复制出来，释放队列空间
+    for (const auto &end : ends)
+    {
+        end.first->release(end.second);
+    }
+
+    // 回收已经退出且读空的线程队列
+    std::unique_lock<std::mutex> guard(rings_mutex_);
+    rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+                                [](const RingPtr &ring) {
+                                    return ring->closed() && ring->head() == ring->tail() && !ring->spilled();
+                                }),
+                 rings_.end());
+}
+
+void AsyncLogging::appendMerged(LogFile &output, Buffer &merge_buffer, const char *data, int len)
+{
+    if (merge_buffer.avail() <= len)
+    {
+        writeOutput(output, merge_buffer.data(), static_cast<size_t>(merge_buffer.length()));
+        merge_buffer.reset();
+    }
+    if (merge_buffer.avail() <= len)
+    {
+        // 比整个合并缓冲区还大的记录直接写入
+        writeOutput(output, data, static_cast<size_t>(len));
+        return;
+    }
+    merge_buffer.append(data, len);
+}
+
+void AsyncLogging::writeDropMarker(LogFile &output, LevelCounts &reported)
+{
+    static const char *kPolicyNames[] = {"block", "drop-newest", "drop-oldest", "drop-by-level"};
+    static const char *kLevelNames[kNumLogLevels] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+    LevelCounts current = droppedCounts();
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < kNumLogLevels; ++i)
+    {
+        messages += current.messages[i] - reported.messages[i];
+        bytes += current.bytes[i] - reported.bytes[i];
+    }
+    if (messages == 0)
+    {
+        return;
+    }
+
+    // 标记与普通日志的格式相同(包括 JSON/logfmt)，级别为 WARN
+    LogStream stream;
+    Logger::beginRecord(stream, Timestamp::now(), CurrentThread::tid(), CurrentThread::name(), Logger::WARN,
+                        DDLOG_SOURCE_FILE_, __LINE__, nullptr);
+    stream << "AsyncLogging dropped " << messages << " messages (" << bytes << " bytes), policy "
+           << kPolicyNames[static_cast<int>(policy_)] << ':';
+    for (int i = 0; i < kNumLogLevels; ++i)
+    {
+        uint64_t level_messages = current.messages[i] - reported.messages[i];
+        if (level_messages > 0)
+        {
+            stream << ' ' << kLevelNames[i] << '=' << level_messages << '/'
+                   << current.bytes[i] - reported.bytes[i] << 'B';
+        }
+    }
+    Logger::finishRecord(stream);
+    writeOutput(output, stream.buffer().data(), static_cast<size_t>(stream.buffer().length()));
+    reported = current;
+}
+
+void AsyncLogging::writeMetrics(LogFile &output)
+{
+    AsyncLoggingMetrics m = metrics();
+    uint64_t accepted_messages = 0;
+    uint64_t accepted_bytes = 0;
+    uint64_t dropped_messages = 0;
+    for (int i = 0; i < kNumLogLevels; ++i)
+    {
+        accepted_messages += m.accepted.messages[i];
+        accepted_bytes += m.accepted.bytes[i];
+        dropped_messages += m.dropped.messages[i];
+    }
+
+    LogStream stream;
+    Logger::beginRecord(stream, Timestamp::now(), CurrentThread::tid(), CurrentThread::name(), Logger::INFO,
+                        DDLOG_SOURCE_FILE_, __LINE__, nullptr);
+    stream << "AsyncLogging metrics: accepted " << accepted_messages << " messages (" << accepted_bytes
+           << " bytes), dropped " << dropped_messages << ", buffers swapped " << m.buffers_swapped
+           << ", queue high water " << m.queue_high_water << " bytes, batches " << m.batches
+           << ", append " << m.append_ns / 1000 << " us, flush " << m.flush_ns / 1000
+           << " us, file rolls " << m.file_rolls << ", write errors " << m.write_errors << ", batch latency(us):";
+    for (int i = 0; i < AsyncLoggingMetrics::kLatencyBuckets; ++i)
+    {
+        if (m.batch_latency[i] > 0)
+        {
+            stream << ' ' << (1 << i) << '=' << m.batch_latency[i];
+        }
+    }
+    Logger::finishRecord(stream);
+    writeOutput(output, stream.buffer().data(), static_cast<size_t>(stream.buffer().length()));
+}
+
+void AsyncLogging::writeRecovered(LogFile &output)
+{
+    std::string data;
+    pid_t pid = 0;
+    if (!arena_->takeRecovered(&data, &pid))
+    {
+        return;
+    }
+    LogStream stream;
+    Logger::beginRecord(stream, Timestamp::now(), CurrentThread::tid(), CurrentThread::name(), Logger::WARN,
+                        DDLOG_SOURCE_FILE_, __LINE__, nullptr);
+    stream << "AsyncLogging recovered " << data.size() << " bytes not written by process " << pid << " from "
+           << arena_->path().c_str();
+    Logger::finishRecord(stream);
+    writeOutput(output, stream.buffer().data(), static_cast<size_t>(stream.buffer().length()));
+    writeOutput(output, data.data(), data.size());
+    output.flush();
+}
+
+AsyncLogging::BufferPtr AsyncLogging::takeBuffer(BufferVector &buffers)
+{
+    if (buffers.empty())
+    {
+        return pool_.acquire();
+    }
+    BufferPtr buffer = std::move(buffers.back());
+    buffers.pop_back();
+    // 清理缓冲区
+    buffer->reset();
+    return buffer;
+}
+
 // 异步日志线程
 void AsyncLogging::writeThread()
 {
+    ::pthread_setname_np(::pthread_self(), "AsyncLogging");
+
     // 创建两个Buffer
-    BufferPtr new_buffer1(new Buffer);
-    BufferPtr new_buffer2(new Buffer);
-    new_buffer1->bzero();
-    new_buffer2->bzero();
+    BufferPtr new_buffer1(pool_.acquire());
+    BufferPtr new_buffer2(pool_.acquire());
+    // 合并暂存队列使用的Buffer
+    BufferPtr merge_buffer(staging_ ? pool_.acquire() : nullptr);
     // Buffer队列
     BufferVector buffers_to_write;
     buffers_to_write.reserve(8);
+    // 已经写入标记的丢弃统计
+    LevelCounts reported_drops;
+    memset(&reported_drops, 0, sizeof(reported_drops));
 
-    LogFile output(roll_size_);
+    LogFile output(roll_size_, file_options_);
+    if (arena_)
+    {
+        writeRecovered(output);
+    }
+    // 上一次输出运行指标的时间
+    int64_t last_metrics = Timestamp::monotonicNanos();
 
     while (running_)
     {
@@ -78,56 +664,133 @@ void AsyncLogging::writeThread()
             }
 
             // 这里还需要将 current_buffer_ 放入列表中
+            size_t queued = queued_bytes_ + current_buffer_->length();
+            if (queued > counters_.queue_high_water.load(std::memory_order_relaxed))
+            {
+                counters_.queue_high_water.store(queued, std::memory_order_relaxed);
+            }
             buffers_.push_back(std::move(current_buffer_));
             // 将new_buffer1 设为当前缓冲区
             current_buffer_ = std::move(new_buffer1);
             // 转移buffers_
             buffers_to_write.swap(buffers_);
+            queued_bytes_ = 0;
             if (!next_buffer_)
             {
                 // 将 next_buffer_ 设置为 new_buffer2：这样前端始终有一个预备的buffer可以使用
                 next_buffer_ = std::move(new_buffer2);
             }
         } // 退出临界区
+        // 队列已经取走，唤醒被阻塞的前端线程
+        not_full_.notify_all();
 
-        if (buffers_to_write.size() > 16)
-        {
-            char buf[256];
-            snprintf(buf, sizeof(buf), "Dropped log messages %zd larger buffers\n", buffers_to_write.size() - 2);
-            fputs(buf, stderr);
-            // 如果日志太多，丢掉多余的，只留两个缓冲区
-            buffers_to_write.erase(buffers_to_write.begin() + 2, buffers_to_write.end());
-        }
+        writeBatch(output, buffers_to_write, merge_buffer.get(), reported_drops);
+        // 取回已经写完的缓冲区(可能是之前批次提交的)
+        collectWritten(output, buffers_to_write, false);
 
-        // 将列表中的日志入到文件中
-        for (const auto &buffer : buffers_to_write)
+        // 定期在日志中输出运行指标
+        int metrics_interval = metrics_interval_.load(std::memory_order_relaxed);
+        if (metrics_interval > 0)
         {
-            output.append(buffer->data(), static_cast<size_t>(buffer->length()));
-        }
-
-        // 写完后调整列表的大小
-        if (buffers_to_write.size() > 2)
-        {
-            buffers_to_write.resize(2);
+            int64_t now = Timestamp::monotonicNanos();
+            if (now - last_metrics >= static_cast<int64_t>(metrics_interval) * 1000000000)
+            {
+                writeMetrics(output);
+                last_metrics = now;
+            }
         }
 
         if (!new_buffer1)
         {
             // 从 buffers_to_write中弹出一个作为newBUffer1
-            new_buffer1 = std::move(buffers_to_write.back());
-            buffers_to_write.pop_back();
-            // 清理 newBuffer1
-            new_buffer1->reset();
+            new_buffer1 = takeBuffer(buffers_to_write);
         }
 
         if (!new_buffer2)
         {
-            new_buffer2 = std::move(buffers_to_write.back());
-            buffers_to_write.pop_back();
-            new_buffer2->reset();
+            new_buffer2 = takeBuffer(buffers_to_write);
+        }
+        // 写完后多余的缓冲区归还缓冲池，不再释放内存
+        for (auto &buffer : buffers_to_write)
+        {
+            pool_.release(std::move(buffer));
         }
         buffers_to_write.clear();
-        output.flush();
     }
+
+    // 退出前写入剩余的日志
+    {
+        std::unique_lock<std::mutex> guard(mutex_);
+        buffers_.push_back(std::move(current_buffer_));
+        buffers_to_write.swap(buffers_);
+        queued_bytes_ = 0;
+    }
+    not_full_.notify_all();
+    writeBatch(output, buffers_to_write, merge_buffer.get(), reported_drops);
+    // 等待所有写入完成后才能归还缓冲区
+    collectWritten(output, buffers_to_write, true);
+    for (auto &buffer : buffers_to_write)
+    {
+        pool_.release(std::move(buffer));
+    }
+}
+
+void AsyncLogging::collectWritten(LogFile &output, BufferVector &buffers, bool wait)
+{
+    std::vector<void *> tags;
+    output.takeCompleted(tags, wait);
+    buffers.clear();
+    for (void *tag : tags)
+    {
+        buffers.push_back(pool_.adopt(static_cast<Buffer *>(tag)));
+    }
+}
+
+void AsyncLogging::writeBatch(LogFile &output, BufferVector &buffers, Buffer *merge_buffer,
+                              LevelCounts &reported_drops)
+{
+    int64_t start = Timestamp::monotonicNanos();
+    bump(counters_.buffers_swapped, buffers.size());
+
+    // 前端按溢出策略丢弃了消息时，在日志中留下标记
+    writeDropMarker(output, reported_drops);
+
+    // 将列表中的日志入到文件中
+    for (auto &buffer : buffers)
+    {
+        countAccepted(buffer->counts());
+        int64_t submit_start = Timestamp::monotonicNanos();
+        const char *data = buffer->data();
+        size_t len = static_cast<size_t>(buffer->length());
+        // 缓冲区的所有权交给 output，写完后取回
+        output.submit(data, len, buffer.release());
+        bump(counters_.append_ns, static_cast<uint64_t>(Timestamp::monotonicNanos() - submit_start));
+    }
+    buffers.clear();
+
+    // 收集各个线程暂存队列中的日志
+    if (merge_buffer)
+    {
+        drainStaging(output, *merge_buffer);
+    }
+
+    int64_t flush_start = Timestamp::monotonicNanos();
     output.flush();
+    int64_t end = Timestamp::monotonicNanos();
+    bump(counters_.flush_ns, static_cast<uint64_t>(end - flush_start));
+
+    // 文件滚动和写错误由 LogFile 统计，这里只同步过来
+    counters_.file_rolls.store(output.rollCount(), std::memory_order_relaxed);
+    counters_.write_errors.store(output.writeErrors(), std::memory_order_relaxed);
+    bump(counters_.batches, 1);
+
+    // 按耗时的 log2(微秒) 计入直方图
+    uint64_t micros = static_cast<uint64_t>(end - start) / 1000;
+    int bucket = 0;
+    while (micros > 1 && bucket < AsyncLoggingMetrics::kLatencyBuckets - 1)
+    {
+        micros >>= 1;
+        ++bucket;
+    }
+    bump(counters_.batch_latency[bucket], 1);
 }
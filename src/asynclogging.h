@@ -1,6 +1,10 @@
 #pragma once
 
+#include "logfile.h"
 #include "logstream.h"
+#include "stagingring.h"
+#include "bufferarena.h"
+#include "bufferpool.h"
 #include "noncopyable.h"
 
 #include <vector>
@@ -10,14 +14,110 @@
 #include <thread>
 #include <atomic>
 
+// 日志级别个数，与 Logger::LogLevel 一一对应(本文件不依赖 logger.h)
+const int kNumLogLevels = 6;
+
+// 每个级别的消息数和字节数
+struct LevelCounts
+{
+    uint64_t messages[kNumLogLevels];
+    uint64_t bytes[kNumLogLevels];
+};
+
+/**
+ * 异步日志的运行指标快照
+ */
+struct AsyncLoggingMetrics
+{
+    // 批次耗时直方图的桶数：第 i 个桶为 [2^i, 2^(i+1)) 微秒，第一个桶包括更小的值，最后一个桶包括更大的值
+    static const int kLatencyBuckets = 20;
+
+    LevelCounts accepted;                    // 每个级别写入文件的消息数和字节数
+    LevelCounts dropped;                     // 每个级别被丢弃的消息数和字节数
+    uint64_t buffers_swapped;                // 交给日志线程的缓冲区数
+    uint64_t queue_high_water;               // 等待写入的队列的最大长度(字节)
+    uint64_t batches;                        // 日志线程处理的批次数
+    uint64_t append_ns;                      // output.append 累计耗时(纳秒)
+    uint64_t flush_ns;                       // output.flush 累计耗时(纳秒)
+    uint64_t file_rolls;                     // 日志文件滚动次数
+    uint64_t write_errors;                   // 写文件失败次数
+    uint64_t batch_latency[kLatencyBuckets]; // 每批次耗时的直方图
+};
+
+/**
+ * 缓冲区队列超过上限时的处理策略
+ */
+enum class OverflowPolicy
+{
+    kBlock,       // 阻塞前端线程，最多等待 block_timeout_ms，超时后丢弃新消息
+    kDropNewest,  // 丢弃新消息
+    kDropOldest,  // 丢弃队列中最旧的缓冲区
+    kDropByLevel, // 丢弃低于 min_kept_level 的新消息，高级别的消息最多允许队列达到上限的两倍
+};
+
 class AsyncLogging : noncopyable
 {
-    using Buffer = LogBuffer<KLargeBuffer>;
-    using BufferVector = std::vector<std::unique_ptr<Buffer>>;
-    using BufferPtr = BufferVector::value_type;
+    /**
+     * 大缓冲区：同时记录其中每个级别的消息数和字节数
+     * 整块丢弃时用于精确统计
+     */
+    class Buffer : public LogBuffer<KLargeBuffer>
+    {
+    public:
+        Buffer() : arena_(nullptr), slot_(nullptr) { clearCounts(); }
+
+        // 缓冲区位于 arena 的槽位中：每次写入后在槽位中记录已写入的长度，崩溃后可以恢复
+        void attach(BufferArena *arena)
+        {
+            arena_ = arena;
+            slot_ = arena->attach(this, data());
+        }
+
+        using LogBuffer<KLargeBuffer>::append;
+        // messages 为这次写入的消息数：分段写入的大消息只在最后一段计数
+        void append(const char *buf, int len, int level, int messages = 1)
+        {
+            LogBuffer<KLargeBuffer>::append(buf, len);
+            counts_.messages[level] += messages;
+            counts_.bytes[level] += len;
+            if (slot_)
+            {
+                arena_->commit(slot_, static_cast<uint64_t>(length()));
+            }
+        }
+        void reset()
+        {
+            LogBuffer<KLargeBuffer>::reset();
+            clearCounts();
+            if (slot_)
+            {
+                BufferArena::clear(slot_);
+            }
+        }
+        const LevelCounts &counts() const { return counts_; }
+
+    private:
+        void clearCounts() { memset(&counts_, 0, sizeof(counts_)); }
+
+        LevelCounts counts_;
+        BufferArena *arena_;      // 所在的文件映射区域，为空时位于匿名内存
+        BufferArena::Slot *slot_; // 所在槽位的状态
+    };
+    using BufferPtr = BufferPool<Buffer>::Ptr;
+    using BufferVector = std::vector<BufferPtr>;
+    using RingPtr = std::shared_ptr<StagingRing>;
 
 public:
-    AsyncLogging(int flush_interval = 500, int roll_size = 20 * 1024 * 1024);
+    /**
+     * staging 为 true 时，每个前端线程把日志写入自己独占的无锁暂存队列，
+     * 由日志线程统一收集，前端不再竞争 mutex_（暂存队列满时才退回加锁的路径）
+     * file_options 为日志文件的选项：写入方式为 FileBackend::kUring 时，
+     * 大缓冲区直接提交给 io_uring 异步写入，写完后才回收；
+     * 开启 crash_safe 时，大缓冲区放在 log/<程序名>.buf 文件的共享映射中，
+     * 进程崩溃时没有写入日志文件的内容在下次启动时写入日志(或者用 logrecover 工具取出)
+     */
+    AsyncLogging(int flush_interval = 500, int roll_size = 20 * 1024 * 1024, bool staging = false,
+                 const LogFileOptions &file_options = LogFileOptions());
     ~AsyncLogging()
     {
         if (running_)
@@ -26,26 +126,143 @@ public:
         }
     }
 
-    void append(const char *buf, int len);
+    // level 为 Logger::LogLevel，用于溢出策略和丢弃统计，默认为 INFO
+    // 日志线程停止之后的日志计入丢弃
+    // 比整个缓冲区还大的消息分段写入连续的几个缓冲区
+    void append(const char *buf, int len, int level = 2);
+
+    /**
+     * 设置缓冲区队列的溢出策略
+     * queue_limit_bytes: 等待日志线程写入的数据量上限
+     * block_timeout_ms: kBlock 策略下前端最多等待的时间
+     * min_kept_level: kDropByLevel 策略下保留的最低级别，默认 WARN
+     */
+    void setOverflowPolicy(OverflowPolicy policy, size_t queue_limit_bytes,
+                           int block_timeout_ms = 100, int min_kept_level = 3);
+    // 返回被丢弃的消息数和字节数
+    LevelCounts droppedCounts() const;
+
+    /**
+     * 设置大缓冲区的缓冲池：空闲列表保留 min_count 到 max_count 个缓冲区
+     * flags 为 BufferPoolOptions::Flags 的组合(预先缺页、mlock、大页)
+     */
+    void setBufferPool(size_t min_count, size_t max_count, int flags);
+    // 返回运行指标的快照，可以在任意线程调用
+    AsyncLoggingMetrics metrics() const;
+    // 每隔 seconds 秒在日志中输出一行运行指标，0 表示不输出
+    void setMetricsInterval(int seconds) { metrics_interval_ = seconds; }
+
+    // 返回缓冲池的统计信息(包括同时使用的缓冲区数的最大值)
+    BufferPoolOptions::Stats bufferPoolStats() const { return pool_.stats(); }
+
+    /**
+     * 在当前线程的暂存队列中预留 len 字节，返回写入位置
+     * 未开启暂存队列、日志线程已经停止或者队列已满时返回 nullptr
+     * 预留成功后必须调用 commit() 发布
+     */
+    char *reserve(int len);
+    // 发布 reserve() 得到的记录，kind 为 StagingRing::Kind
+    void commit(int len, int64_t time, uint32_t kind, int level);
+    // 放弃 reserve() 得到的空间，不发布任何记录
+    void cancel();
 
     void stop()
     {
         running_ = false;
+        cond_.notify_one();
         thread_.join();
     }
+    // 停止日志线程并等待已经提交的日志写入文件，可以重复调用；在日志线程中调用时什么也不做
+    void shutdown()
+    {
+        if (running_ && std::this_thread::get_id() != thread_.get_id())
+        {
+            stop();
+        }
+    }
 
 private:
     void writeThread();
+    // 加锁写入当前缓冲区
+    void appendLocked(const char *buf, int len, int level);
+    // 把当前缓冲区放入队列并换上新的缓冲区，调用者持有锁
+    void rotateLocked();
+    // 当前缓冲区已满且队列超过上限时按策略处理，返回 false 表示丢弃这条消息
+    // pending 为这条消息除当前缓冲区之外还要放入队列的字节数(分段写入的大消息)
+    bool handleOverflow(std::unique_lock<std::mutex> &guard, int len, int level, size_t pending);
+    // 记录丢弃的消息
+    void countDropped(int level, uint64_t messages, uint64_t bytes);
+    // 从写完的缓冲区中取出一个，没有时从缓冲池中取
+    BufferPtr takeBuffer(BufferVector &buffers);
+    // 如果有新的丢弃，向日志中写入一条标记
+    void writeDropMarker(LogFile &output, LevelCounts &reported);
+    // 写入一批缓冲区和暂存队列中的日志，然后刷新文件
+    // 大缓冲区交给 output 后从 buffers 中移出，写完后由 collectWritten() 取回
+    void writeBatch(LogFile &output, BufferVector &buffers, Buffer *merge_buffer, LevelCounts &reported_drops);
+    // 取回已经写完的大缓冲区，wait 为 true 时等待所有写入完成
+    void collectWritten(LogFile &output, BufferVector &buffers, bool wait);
+    // 写入文件并统计耗时
+    void writeOutput(LogFile &output, const char *data, size_t len);
+    // 向日志中写入一行运行指标
+    void writeMetrics(LogFile &output);
+    // 写入上次运行崩溃时没有写入日志文件的内容
+    void writeRecovered(LogFile &output);
+    // 统计写入文件的消息
+    void countAccepted(const LevelCounts &counts);
+    // 开启 crash_safe 时创建 arena_，失败或未开启时返回 nullptr
+    BufferArena *createArena(const LogFileOptions &file_options);
+    // 返回当前线程的暂存队列，第一次调用时注册
+    StagingRing *localRing();
+    // 收集所有暂存队列中的日志，按时间戳合并后写入文件
+    void drainStaging(LogFile &output, Buffer &merge_buffer);
+    // 把一条记录加入合并缓冲区，放不下时先写出缓冲区
+    void appendMerged(LogFile &output, Buffer &merge_buffer, const char *data, int len);
 
-    const int flush_interval_;  // 定时缓冲时间
-    const int roll_size_;       //
-    std::atomic<bool> running_; // 是否正在运行
-    std::thread thread_;        // 执行改异步日志记录器的线程
+    const int flush_interval_;          // 定时缓冲时间
+    const int roll_size_;               //
+    const bool staging_;                // 是否使用线程暂存队列
+    const LogFileOptions file_options_; // 日志文件的选项
+    const uint64_t id_;                 // 实例编号：用于区分线程局部的暂存队列属于哪个实例
+    std::atomic<bool> running_;         // 是否正在运行
 
     std::mutex mutex_;
     std::condition_variable cond_;
+    std::condition_variable not_full_; // kBlock 策略下等待队列有空间
+
+    OverflowPolicy policy_;                                // 溢出策略
+    size_t queue_limit_bytes_;                             // 队列上限(字节)
+    std::atomic<size_t> spill_limit_bytes_;                // 每个线程的暂存队列溢出区的上限，与队列上限相同，不加锁读取
+    int block_timeout_ms_;                                 // kBlock 最多等待时间
+    int min_kept_level_;                                   // kDropByLevel 保留的最低级别
+    size_t queued_bytes_;                                  // 队列中等待写入的字节数
+    std::atomic<uint64_t> dropped_messages_[kNumLogLevels]; // 丢弃的消息数
+    std::atomic<uint64_t> dropped_bytes_[kNumLogLevels];    // 丢弃的字节数
+
+    // 运行指标：queue_high_water 在 mutex_ 内更新，其余只由日志线程更新
+    struct Counters
+    {
+        std::atomic<uint64_t> accepted_messages[kNumLogLevels];
+        std::atomic<uint64_t> accepted_bytes[kNumLogLevels];
+        std::atomic<uint64_t> buffers_swapped;
+        std::atomic<uint64_t> queue_high_water;
+        std::atomic<uint64_t> batches;
+        std::atomic<uint64_t> append_ns;
+        std::atomic<uint64_t> flush_ns;
+        std::atomic<uint64_t> file_rolls;
+        std::atomic<uint64_t> write_errors;
+        std::atomic<uint64_t> batch_latency[AsyncLoggingMetrics::kLatencyBuckets];
+    };
+    Counters counters_;
+    std::atomic<int> metrics_interval_; // 定期输出运行指标的间隔(秒)
+
+    std::unique_ptr<BufferArena> arena_; // 放置大缓冲区的文件映射区域，未开启 crash_safe 时为空
+    BufferPool<Buffer> pool_;            // 大缓冲区的缓冲池，必须在所有缓冲区之前构造
+    BufferPtr current_buffer_;           // 当前缓冲区
+    BufferPtr next_buffer_;              // 预备缓冲区
+    BufferVector buffers_;               // 缓冲区队列：待写入文件
+
+    std::mutex rings_mutex_;     // 只在线程注册和日志线程收集时使用
+    std::vector<RingPtr> rings_; // 所有线程的暂存队列
 
-    BufferPtr current_buffer_; // 当前缓冲区
-    BufferPtr next_buffer_;    // 预备缓冲区
-    BufferVector buffers_;     // 缓冲区队列：待写入文件
-};
\ No newline at end of file
+    std::thread thread_; // 执行改异步日志记录器的线程，最后初始化
+};
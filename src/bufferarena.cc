@@ -0,0 +1,375 @@
+#include "bufferarena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+namespace
+{
+const char kMagic[8] = {'D', 'D', 'L', 'O', 'G', 'B', 'U', 'F'};
+const uint32_t kVersion = 1;
+const size_t kPageSize = 4096;
+
+// 所有 BufferArena，供崩溃处理使用
+const int kMaxArenas = 16;
+std::atomic<BufferArena *> g_arenas[kMaxArenas];
+
+// 安装崩溃处理之前的信号处理方式
+const int kCrashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+struct sigaction g_previous[NSIG];
+std::once_flag g_install_once;
+
+void crashHandler(int sig)
+{
+    BufferArena::flushAllForCrash();
+    // 交给之前的处理方式(默认为终止进程)
+    ::sigaction(sig, &g_previous[sig], nullptr);
+    ::raise(sig);
+}
+
+void installCrashHandler()
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = crashHandler;
+    sigemptyset(&action.sa_mask);
+    for (int sig : kCrashSignals)
+    {
+        ::sigaction(sig, &action, &g_previous[sig]);
+    }
+}
+
+// 写完 len 字节，只使用异步信号安全的函数
+bool writeAll(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// 崩溃时写出的文件：去掉 .buf 后缀，加上 pid
+std::string crashPath(const std::string &path, pid_t pid)
+{
+    std::string prefix = path;
+    if (prefix.size() > 4 && prefix.compare(prefix.size() - 4, 4, ".buf") == 0)
+    {
+        prefix.resize(prefix.size() - 4);
+    }
+    return prefix + "." + std::to_string(pid) + ".crash.log";
+}
+
+bool readAll(int fd, void *data, size_t len, off_t offset)
+{
+    char *p = static_cast<char *>(data);
+    while (len > 0)
+    {
+        ssize_t n = ::pread(fd, p, len, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+} // namespace
+
+BufferArena::BufferArena(const std::string &path, size_t slot_size, int slot_count)
+    : path_(path),
+      fd_(-1),
+      base_(nullptr),
+      size_(0),
+      slots_offset_(0),
+      slot_size_(slot_size),
+      slot_count_(std::min(std::max(slot_count, 1), kMaxSlots)),
+      slots_(nullptr),
+      next_sequence_(nullptr),
+      recovered_pid_(0)
+{
+    crash_path_[0] = '\0';
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        fprintf(stderr, "BufferArena open %s failed: %s\n", path_.c_str(), strerror(errno));
+        return;
+    }
+    if (::flock(fd_, LOCK_EX | LOCK_NB) != 0)
+    {
+        fprintf(stderr, "BufferArena %s is in use by another logger\n", path_.c_str());
+        ::close(fd_);
+        fd_ = -1;
+        return;
+    }
+
+    // 先取出上次运行留下的数据，追加到上次进程的崩溃文件并落盘之后，才能按新的布局初始化(会清空文件)
+    // 保存失败时不使用这个文件，数据留给 logrecover
+    if (readPending(fd_, &recovered_, &recovered_pid_, false) && !recovered_.empty() && !saveRecovered())
+    {
+        fprintf(stderr, "BufferArena cannot save data recovered from %s, leaving it for logrecover\n", path_.c_str());
+        std::string().swap(recovered_);
+        ::close(fd_);
+        fd_ = -1;
+        return;
+    }
+
+    size_t table = sizeof(Header) + sizeof(Slot) * static_cast<size_t>(slot_count_);
+    slots_offset_ = (table + kPageSize - 1) & ~(kPageSize - 1);
+    size_ = slots_offset_ + slot_size_ * static_cast<size_t>(slot_count_);
+    // 预先分配空间：写共享映射时不会因为磁盘满而收到 SIGBUS
+    int err = ::ftruncate(fd_, 0) == 0 ? ::posix_fallocate(fd_, 0, static_cast<off_t>(size_)) : errno;
+    void *base = err == 0 ? ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, 0)
+                           : MAP_FAILED;
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "BufferArena map %s failed: %s\n", path_.c_str(), strerror(err ? err : errno));
+        ::close(fd_);
+        fd_ = -1;
+        return;
+    }
+    base_ = static_cast<char *>(base);
+
+    Header *header = reinterpret_cast<Header *>(base_);
+    memset(header, 0, slots_offset_);
+    memcpy(header->magic, kMagic, sizeof(kMagic));
+    header->version = kVersion;
+    header->slot_count = static_cast<uint32_t>(slot_count_);
+    header->slot_size = slot_size_;
+    header->slots_offset = slots_offset_;
+    header->pid = ::getpid();
+    slots_ = reinterpret_cast<Slot *>(header + 1);
+    next_sequence_ = &header->next_sequence;
+
+    free_.reserve(slot_count_);
+    for (int i = slot_count_ - 1; i >= 0; --i)
+    {
+        free_.push_back(i);
+    }
+
+    // 崩溃时写出的文件，提前生成
+    snprintf(crash_path_, sizeof(crash_path_), "%s", crashPath(path_, ::getpid()).c_str());
+
+    std::call_once(g_install_once, installCrashHandler);
+    for (auto &slot : g_arenas)
+    {
+        BufferArena *expected = nullptr;
+        if (slot.compare_exchange_strong(expected, this))
+        {
+            break;
+        }
+    }
+}
+
+BufferArena::~BufferArena()
+{
+    for (auto &slot : g_arenas)
+    {
+        BufferArena *expected = this;
+        slot.compare_exchange_strong(expected, nullptr);
+    }
+    if (base_)
+    {
+        ::munmap(base_, size_);
+    }
+    if (fd_ >= 0)
+    {
+        // 正常退出：缓冲区都已经写入日志文件，文件保留供下次使用
+        ::close(fd_);
+    }
+}
+
+void *BufferArena::acquire()
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (free_.empty())
+    {
+        return nullptr;
+    }
+    int index = free_.back();
+    free_.pop_back();
+    return base_ + slots_offset_ + slot_size_ * static_cast<size_t>(index);
+}
+
+void BufferArena::release(void *memory)
+{
+    size_t index = (static_cast<char *>(memory) - base_ - slots_offset_) / slot_size_;
+    clear(&slots_[index]);
+    std::unique_lock<std::mutex> guard(mutex_);
+    free_.push_back(static_cast<int>(index));
+}
+
+BufferArena::Slot *BufferArena::attach(const void *memory, const char *data)
+{
+    size_t index = (static_cast<const char *>(memory) - base_ - slots_offset_) / slot_size_;
+    Slot *slot = &slots_[index];
+    clear(slot);
+    slot->data_offset = static_cast<uint64_t>(data - base_);
+    return slot;
+}
+
+bool BufferArena::saveRecovered()
+{
+    std::string path = crashPath(path_, recovered_pid_);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = writeAll(fd, recovered_.data(), recovered_.size()) && ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+bool BufferArena::takeRecovered(std::string *data, pid_t *pid)
+{
+    if (recovered_.empty())
+    {
+        return false;
+    }
+    data->swap(recovered_);
+    *pid = recovered_pid_;
+    std::string().swap(recovered_);
+    return true;
+}
+
+bool BufferArena::readPending(int fd, std::string *data, pid_t *pid, bool clear)
+{
+    Header header;
+    if (!readAll(fd, &header, sizeof(header), 0) || memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion || header.slot_count > static_cast<uint32_t>(kMaxSlots))
+    {
+        return false;
+    }
+    std::vector<Slot> slots(header.slot_count);
+    if (!readAll(fd, slots.data(), sizeof(Slot) * slots.size(), sizeof(header)))
+    {
+        return false;
+    }
+    *pid = header.pid;
+
+    // 按序号恢复写入顺序
+    std::vector<int> pending;
+    for (int i = 0; i < static_cast<int>(slots.size()); ++i)
+    {
+        if (slots[i].committed > 0 && slots[i].committed <= header.slot_size)
+        {
+            pending.push_back(i);
+        }
+    }
+    std::sort(pending.begin(), pending.end(),
+              [&slots](int a, int b) { return slots[a].sequence < slots[b].sequence; });
+    for (int i : pending)
+    {
+        size_t old_size = data->size();
+        data->resize(old_size + slots[i].committed);
+        if (!readAll(fd, &(*data)[old_size], slots[i].committed, static_cast<off_t>(slots[i].data_offset)))
+        {
+            data->resize(old_size);
+            continue;
+        }
+        if (clear)
+        {
+            uint64_t zero = 0;
+            off_t offset = static_cast<off_t>(sizeof(header) + sizeof(Slot) * i + offsetof(Slot, committed));
+            ::pwrite(fd, &zero, sizeof(zero), offset);
+        }
+    }
+    return true;
+}
+
+bool BufferArena::recoverFile(const std::string &path, std::string *data, pid_t *pid, bool clear)
+{
+    int fd = ::open(path.c_str(), (clear ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = true;
+    if (clear && ::flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        // 正在被使用：只读取，不清零
+        clear = false;
+        ok = false;
+    }
+    ok = readPending(fd, data, pid, clear) && ok;
+    ::close(fd);
+    return ok;
+}
+
+void BufferArena::flushForCrash()
+{
+    // 选择排序：按序号写出，不分配内存
+    bool done[kMaxSlots] = {false};
+    int fd = -1;
+    for (;;)
+    {
+        int next = -1;
+        for (int i = 0; i < slot_count_; ++i)
+        {
+            if (!done[i] && __atomic_load_n(&slots_[i].committed, __ATOMIC_ACQUIRE) > 0 &&
+                (next < 0 || slots_[i].sequence < slots_[next].sequence))
+            {
+                next = i;
+            }
+        }
+        if (next < 0)
+        {
+            break;
+        }
+        done[next] = true;
+        if (fd < 0)
+        {
+            fd = ::open(crash_path_, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0)
+            {
+                // 留在文件中，下次启动时恢复
+                return;
+            }
+        }
+        uint64_t committed = __atomic_load_n(&slots_[next].committed, __ATOMIC_ACQUIRE);
+        if (writeAll(fd, base_ + slots_[next].data_offset, committed))
+        {
+            clear(&slots_[next]);
+        }
+    }
+    if (fd >= 0)
+    {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+void BufferArena::flushAllForCrash()
+{
+    for (auto &slot : g_arenas)
+    {
+        if (BufferArena *arena = slot.load(std::memory_order_acquire))
+        {
+            arena->flushForCrash();
+        }
+    }
+}
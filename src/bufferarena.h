@@ -0,0 +1,127 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+
+/**
+ * 文件映射的缓冲区区域：异步日志的大缓冲区放在文件的共享映射(MAP_SHARED)中，
+ * 进程崩溃后缓冲区的内容仍然保存在页缓存和文件里
+ * 文件开头是 Header 和每个槽位的 Slot，之后是 slot_count 个槽位，每个槽位放一个缓冲区对象
+ * 缓冲区每次写入后更新 Slot::committed，写入日志文件之后清零；
+ * 下次启动时(或者用 logrecover 工具)取出 committed 不为 0 的槽位，按序号恢复还没有写入日志文件的内容
+ * 同一个文件同时只能被一个 BufferArena 使用(flock)
+ */
+class BufferArena : noncopyable
+{
+public:
+    // 槽位的状态，位于文件开头。字段用 __atomic 内建函数访问
+    struct Slot
+    {
+        uint64_t sequence;    // 缓冲区第一次写入时分配的序号，恢复时按它排序
+        uint64_t committed;   // 已经写入缓冲区的字节数，0 表示没有需要恢复的数据
+        uint64_t data_offset; // 缓冲区数据相对文件开头的偏移
+        uint64_t reserved;
+    };
+
+    // 最多的槽位数
+    static const int kMaxSlots = 64;
+
+    /**
+     * 打开(或创建)path，划分为 slot_count 个 slot_size 字节的槽位
+     * 文件中有上次运行没有写入日志文件的数据时，先读取出来追加到 <文件名>.<上次的pid>.crash.log 并 fsync，
+     * 之后才清空文件，数据同时由 takeRecovered() 取走
+     * 失败时(例如文件正在被其他进程使用，或者恢复的数据无法保存) ok() 返回 false
+     */
+    BufferArena(const std::string &path, size_t slot_size, int slot_count);
+    ~BufferArena();
+
+    bool ok() const { return base_ != nullptr; }
+    const std::string &path() const { return path_; }
+
+    // 取出一个空闲槽位，返回它的内存，没有空闲槽位时返回 nullptr
+    void *acquire();
+    // 归还槽位
+    void release(void *memory);
+    // memory 是否是某个槽位
+    bool contains(const void *memory) const
+    {
+        const char *p = static_cast<const char *>(memory);
+        return base_ != nullptr && p >= base_ + slots_offset_ && p < base_ + size_;
+    }
+
+    // 返回 memory 所在槽位的状态，并记录缓冲区数据 data 的位置
+    Slot *attach(const void *memory, const char *data);
+    // 缓冲区中已经写入 length 字节：第一次写入时分配序号
+    void commit(Slot *slot, uint64_t length)
+    {
+        if (__atomic_load_n(&slot->committed, __ATOMIC_RELAXED) == 0)
+        {
+            __atomic_store_n(&slot->sequence, __atomic_add_fetch(next_sequence_, 1, __ATOMIC_RELAXED),
+                             __ATOMIC_RELAXED);
+        }
+        // release：先写入数据，再发布长度
+        __atomic_store_n(&slot->committed, length, __ATOMIC_RELEASE);
+    }
+    // 缓冲区的内容已经写入日志文件或者被丢弃
+    static void clear(Slot *slot) { __atomic_store_n(&slot->committed, 0, __ATOMIC_RELEASE); }
+
+    // 取走启动时恢复的数据，pid 为上次使用该文件的进程
+    bool takeRecovered(std::string *data, pid_t *pid);
+
+    /**
+     * 崩溃处理：把所有 BufferArena 中还没有写入日志文件的内容追加到 <文件名>.<pid>.crash.log
+     * 只使用异步信号安全的函数，写完的槽位清零，下次启动时不再重复恢复
+     */
+    static void flushAllForCrash();
+
+    /**
+     * 读取 path 中还没有写入日志文件的数据(按写入顺序)，供 logrecover 工具使用
+     * clear 为 true 时读取后清零；文件正在被其他进程使用时不清零并返回 false
+     */
+    static bool recoverFile(const std::string &path, std::string *data, pid_t *pid, bool clear);
+
+private:
+    // 文件头
+    struct Header
+    {
+        char magic[8];          // "DDLOGBUF"
+        uint32_t version;       // 格式版本
+        uint32_t slot_count;    // 槽位数
+        uint64_t slot_size;     // 每个槽位的大小
+        uint64_t slots_offset;  // 第一个槽位相对文件开头的偏移
+        int32_t pid;            // 最后使用该文件的进程
+        uint32_t reserved;
+        uint64_t next_sequence; // 已经分配的最大序号
+    };
+
+    // 从 fd 中读取需要恢复的数据
+    static bool readPending(int fd, std::string *data, pid_t *pid, bool clear);
+    // 把启动时恢复的数据追加到上次进程的崩溃文件并落盘
+    bool saveRecovered();
+    // 崩溃时写出本文件的数据
+    void flushForCrash();
+
+    const std::string path_;
+    int fd_;
+    char *base_;                // 映射的起始地址
+    size_t size_;               // 映射的长度
+    size_t slots_offset_;       // 第一个槽位的偏移
+    size_t slot_size_;          // 每个槽位的大小
+    int slot_count_;            // 槽位数
+    Slot *slots_;               // 槽位的状态
+    uint64_t *next_sequence_;   // 文件头中的 next_sequence
+    char crash_path_[PATH_MAX]; // 崩溃时写出的文件，提前生成
+
+    std::mutex mutex_;
+    std::vector<int> free_; // 空闲的槽位
+
+    std::string recovered_; // 启动时恢复的数据
+    pid_t recovered_pid_;
+};
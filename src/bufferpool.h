@@ -0,0 +1,219 @@
+#pragma once
+
+#include "bufferarena.h"
+#include "noncopyable.h"
+
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <stdio.h>
+#include <sys/mman.h>
+
+// 缓冲池的选项和统计信息，与缓冲区类型无关
+struct BufferPoolOptions
+{
+    // 分配选项
+    enum Flags
+    {
+        kPrefault = 1,  // 分配时预先触发缺页(MAP_POPULATE)
+        kMlock = 2,     // 锁定在内存中，不会被换出
+        kHugePages = 4, // 优先使用大页，不可用时退回 madvise(MADV_HUGEPAGE)
+    };
+
+    // 统计信息
+    struct Stats
+    {
+        size_t free_count;  // 空闲列表中的缓冲区数
+        size_t in_use;      // 正在使用的缓冲区数
+        size_t high_water;  // 同时使用的缓冲区数的最大值
+        size_t allocations; // 累计新分配的次数
+    };
+};
+
+/**
+ * 大缓冲区的对象池
+ * 缓冲区用 mmap 分配并预先触发缺页，可选 mlock 锁定或使用大页，
+ * 用完后放回空闲列表，避免突发流量下反复 malloc/free 几MB的内存
+ * 指定 arena 时优先把缓冲区放在它的槽位中(T 需要提供 attach(BufferArena *))，槽位用完后退回匿名映射
+ */
+template <class T>
+class BufferPool : public BufferPoolOptions, noncopyable
+{
+public:
+    // 释放时只析构对象并归还内存，不经过对象池
+    struct Deleter
+    {
+        BufferArena *arena = nullptr; // 缓冲区可能位于它的槽位中
+
+        void operator()(T *buffer) const
+        {
+            buffer->~T();
+            if (arena && arena->contains(buffer))
+            {
+                arena->release(buffer);
+            }
+            else
+            {
+                ::munmap(buffer, BufferPool::mappedSize());
+            }
+        }
+    };
+    using Ptr = std::unique_ptr<T, Deleter>;
+
+    BufferPool(size_t min_count = 0, size_t max_count = 16, int flags = kPrefault, BufferArena *arena = nullptr)
+        : min_count_(min_count),
+          max_count_(max_count),
+          flags_(flags),
+          arena_(arena),
+          in_use_(0),
+          high_water_(0),
+          allocations_(0)
+    {
+        reserve(min_count_);
+    }
+
+    // 每个缓冲区映射的长度，按大页大小对齐
+    static size_t mappedSize() { return (sizeof(T) + kHugePageSize - 1) & ~(kHugePageSize - 1); }
+
+    // 重新接管交出去的缓冲区(例如异步写入完成后取回的指针)
+    Ptr adopt(T *buffer) const { return Ptr(buffer, Deleter{arena_}); }
+
+    // 修改配置：空闲列表至少保留 min_count 个，最多保留 max_count 个
+    void configure(size_t min_count, size_t max_count, int flags)
+    {
+        {
+            std::unique_lock<std::mutex> guard(mutex_);
+            min_count_ = min_count;
+            max_count_ = max_count < min_count ? min_count : max_count;
+            flags_ = flags;
+            while (free_.size() > max_count_)
+            {
+                free_.pop_back();
+            }
+        }
+        reserve(min_count);
+    }
+
+    // 取出一个缓冲区，空闲列表为空时才分配
+    Ptr acquire()
+    {
+        {
+            std::unique_lock<std::mutex> guard(mutex_);
+            ++in_use_;
+            if (in_use_ > high_water_)
+            {
+                high_water_ = in_use_;
+            }
+            if (!free_.empty())
+            {
+                Ptr buffer = std::move(free_.back());
+                free_.pop_back();
+                return buffer;
+            }
+            ++allocations_;
+        }
+        return allocate();
+    }
+
+    // 归还缓冲区：空闲列表已满时直接释放
+    void release(Ptr buffer)
+    {
+        if (!buffer)
+        {
+            return;
+        }
+        buffer->reset();
+        std::unique_lock<std::mutex> guard(mutex_);
+        --in_use_;
+        if (free_.size() < max_count_)
+        {
+            free_.push_back(std::move(buffer));
+        }
+    }
+
+    Stats stats() const
+    {
+        std::unique_lock<std::mutex> guard(mutex_);
+        return Stats{free_.size(), in_use_, high_water_, allocations_};
+    }
+
+private:
+    // 大页大小，映射长度按它对齐
+    static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+    // 预先分配，使空闲列表中至少有 count 个缓冲区
+    void reserve(size_t count)
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> guard(mutex_);
+                if (free_.size() >= count)
+                {
+                    return;
+                }
+                ++allocations_;
+            }
+            Ptr buffer = allocate();
+            std::unique_lock<std::mutex> guard(mutex_);
+            free_.push_back(std::move(buffer));
+        }
+    }
+
+    Ptr allocate()
+    {
+        if (arena_)
+        {
+            if (void *memory = arena_->acquire())
+            {
+                T *buffer = new (memory) T;
+                buffer->attach(arena_);
+                return Ptr(buffer, Deleter{arena_});
+            }
+        }
+        int flags;
+        {
+            std::unique_lock<std::mutex> guard(mutex_);
+            flags = flags_;
+        }
+        int map_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (flags & kPrefault)
+        {
+            map_flags |= MAP_POPULATE;
+        }
+        void *memory = MAP_FAILED;
+        if (flags & kHugePages)
+        {
+            memory = ::mmap(nullptr, mappedSize(), PROT_READ | PROT_WRITE, map_flags | MAP_HUGETLB, -1, 0);
+        }
+        if (memory == MAP_FAILED)
+        {
+            memory = ::mmap(nullptr, mappedSize(), PROT_READ | PROT_WRITE, map_flags, -1, 0);
+            if (memory == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            if (flags & kHugePages)
+            {
+                // 没有预留的大页时，请求透明大页
+                ::madvise(memory, mappedSize(), MADV_HUGEPAGE);
+            }
+        }
+        if ((flags & kMlock) && ::mlock(memory, mappedSize()) != 0)
+        {
+            perror("BufferPool mlock");
+        }
+        return Ptr(new (memory) T, Deleter{arena_});
+    }
+
+    mutable std::mutex mutex_;
+    size_t min_count_;      // 空闲列表至少保留的个数
+    size_t max_count_;      // 空闲列表最多保留的个数
+    int flags_;             // 分配选项
+    BufferArena *arena_;    // 放置缓冲区的文件映射区域，可以为空
+    std::vector<Ptr> free_; // 空闲列表
+    size_t in_use_;         // 正在使用的缓冲区数
+    size_t high_water_;     // 同时使用的最大值
+    size_t allocations_;    // 累计分配次数
+};
@@ -0,0 +1,253 @@
+#include "compressedlog.h"
+#include "timestamp.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef DDLOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+// 压缩输出缓冲区的大小：超过时先写入文件，帧本身不受限制
+const size_t kOutBufferSize = 1024 * 1024;
+// gzip 格式：windowBits 加 16
+const int kGzipWindowBits = 15 + 16;
+} // namespace
+
+#ifdef DDLOG_HAVE_ZLIB
+struct CompressingWriter::Stream
+{
+    z_stream z;
+};
+#else
+struct CompressingWriter::Stream
+{
+};
+#endif
+
+CompressingWriter::CompressingWriter(std::unique_ptr<LogWriter> file, const std::string &index_name, int level)
+    : file_(std::move(file)),
+      stream_(new Stream),
+      index_(::fopen(index_name.c_str(), "ae")),
+      ok_(false),
+      out_(kOutBufferSize)
+{
+    memset(&frame_, 0, sizeof(frame_));
+    frame_.offset = static_cast<uint64_t>(file_->writtenBytes());
+#ifdef DDLOG_HAVE_ZLIB
+    memset(&stream_->z, 0, sizeof(stream_->z));
+    ok_ = ::deflateInit2(&stream_->z, level, Z_DEFLATED, kGzipWindowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+#else
+    (void)level;
+#endif
+    if (!ok_)
+    {
+        fprintf(stderr, "CompressingWriter: compression unavailable, writing uncompressed data\n");
+    }
+}
+
+CompressingWriter::~CompressingWriter()
+{
+    flush();
+#ifdef DDLOG_HAVE_ZLIB
+    if (ok_)
+    {
+        ::deflateEnd(&stream_->z);
+    }
+#endif
+    if (index_)
+    {
+        ::fclose(index_);
+    }
+}
+
+bool CompressingWriter::deflateInput(const char *data, size_t len, bool finish)
+{
+#ifdef DDLOG_HAVE_ZLIB
+    z_stream &z = stream_->z;
+    z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    z.avail_in = static_cast<uInt>(len);
+    bool ok = true;
+    for (;;)
+    {
+        z.next_out = reinterpret_cast<Bytef *>(out_.data());
+        z.avail_out = static_cast<uInt>(out_.size());
+        int ret = ::deflate(&z, finish ? Z_FINISH : Z_NO_FLUSH);
+        size_t produced = out_.size() - z.avail_out;
+        if (produced > 0)
+        {
+            ok = file_->append(out_.data(), produced) && ok;
+            frame_.size += static_cast<uint32_t>(produced);
+            written_bytes_ += static_cast<off_t>(produced);
+        }
+        if (ret == Z_STREAM_ERROR)
+        {
+            return false;
+        }
+        // 输入已经用完，并且(结束帧时)压缩流已经结束
+        if (finish ? ret == Z_STREAM_END : (z.avail_in == 0 && z.avail_out != 0))
+        {
+            break;
+        }
+    }
+    return ok;
+#else
+    (void)finish;
+    return file_->append(data, len);
+#endif
+}
+
+bool CompressingWriter::append(const char *line, const size_t len)
+{
+    if (len == 0)
+    {
+        return true;
+    }
+    if (!ok_)
+    {
+        written_bytes_ += static_cast<off_t>(len);
+        return file_->append(line, len);
+    }
+    if (frame_.raw_size == 0)
+    {
+        frame_.first_time = Timestamp::now();
+    }
+    frame_.raw_size += static_cast<uint32_t>(len);
+    return deflateInput(line, len, false);
+}
+
+bool CompressingWriter::flush()
+{
+    bool ok = true;
+    if (ok_ && frame_.raw_size > 0)
+    {
+        ok = deflateInput(nullptr, 0, true);
+#ifdef DDLOG_HAVE_ZLIB
+        ::deflateReset(&stream_->z);
+#endif
+        frame_.last_time = Timestamp::now();
+        if (index_ && ::fwrite(&frame_, sizeof(frame_), 1, index_) != 1)
+        {
+            ok = false;
+        }
+        // 下一帧从这里开始
+        frame_.offset += frame_.size;
+        frame_.raw_offset += frame_.raw_size;
+        frame_.size = 0;
+        frame_.raw_size = 0;
+    }
+    if (index_ && ::fflush(index_) != 0)
+    {
+        ok = false;
+    }
+    return file_->flush() && ok;
+}
+
+bool CompressingWriter::sync()
+{
+    bool ok = flush();
+    if (index_ && ::fsync(::fileno(index_)) != 0)
+    {
+        ok = false;
+    }
+    return file_->sync() && ok;
+}
+
+CompressedLogReader::CompressedLogReader(const std::string &file_name)
+    : fd_(::open(file_name.c_str(), O_RDONLY | O_CLOEXEC))
+{
+    FILE *index = ::fopen((file_name + ".idx").c_str(), "re");
+    if (index == nullptr)
+    {
+        return;
+    }
+    FrameIndexEntry entry;
+    while (::fread(&entry, sizeof(entry), 1, index) == 1)
+    {
+        frames_.push_back(entry);
+    }
+    ::fclose(index);
+}
+
+CompressedLogReader::~CompressedLogReader()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+}
+
+int CompressedLogReader::findByOffset(uint64_t raw_offset) const
+{
+    // 第一个起始位置大于 raw_offset 的帧的前一帧
+    auto it = std::upper_bound(frames_.begin(), frames_.end(), raw_offset,
+                               [](uint64_t offset, const FrameIndexEntry &e) { return offset < e.raw_offset; });
+    if (it == frames_.begin())
+    {
+        return -1;
+    }
+    --it;
+    if (raw_offset >= it->raw_offset + it->raw_size)
+    {
+        return -1;
+    }
+    return static_cast<int>(it - frames_.begin());
+}
+
+int CompressedLogReader::findByTime(int64_t time) const
+{
+    auto it = std::lower_bound(frames_.begin(), frames_.end(), time,
+                               [](const FrameIndexEntry &e, int64_t t) { return e.last_time < t; });
+    return it == frames_.end() ? -1 : static_cast<int>(it - frames_.begin());
+}
+
+bool CompressedLogReader::readFrame(int index, std::string *out) const
+{
+#ifdef DDLOG_HAVE_ZLIB
+    if (fd_ < 0 || index < 0 || index >= static_cast<int>(frames_.size()))
+    {
+        return false;
+    }
+    const FrameIndexEntry &frame = frames_[index];
+    std::vector<char> compressed(frame.size);
+    size_t done = 0;
+    while (done < compressed.size())
+    {
+        ssize_t n = ::pread(fd_, compressed.data() + done, compressed.size() - done,
+                            static_cast<off_t>(frame.offset + done));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+
+    // 每一帧是独立的 gzip 成员，可以单独解压
+    out->resize(frame.raw_size);
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (::inflateInit2(&z, kGzipWindowBits) != Z_OK)
+    {
+        return false;
+    }
+    z.next_in = reinterpret_cast<Bytef *>(compressed.data());
+    z.avail_in = static_cast<uInt>(compressed.size());
+    z.next_out = reinterpret_cast<Bytef *>(&(*out)[0]);
+    z.avail_out = static_cast<uInt>(out->size());
+    int ret = ::inflate(&z, Z_FINISH);
+    ::inflateEnd(&z);
+    return ret == Z_STREAM_END && z.avail_out == 0;
+#else
+    (void)index;
+    (void)out;
+    return false;
+#endif
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "logfile.h"
+#include "noncopyable.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * 边写边压缩的日志文件
+ * 每次 flush() 之间写入的数据(日志线程的一个批次)压缩为一个独立的 gzip 成员(帧)，
+ * 多个成员首尾相接仍然是合法的 gzip 文件，可以直接用 zcat 查看。
+ * 同时在 <文件名>.idx 中为每一帧记录一个 FrameIndexEntry，用于按解压后的偏移或时间随机访问
+ */
+
+// 帧索引：.idx 文件由这些定长记录组成
+struct FrameIndexEntry
+{
+    uint64_t offset;     // 帧在压缩文件中的位置
+    uint64_t raw_offset; // 帧的第一个字节在解压后数据中的位置
+    uint32_t size;       // 压缩后的长度
+    uint32_t raw_size;   // 解压后的长度
+    int64_t first_time;  // 帧中第一次写入的时间(微秒)
+    int64_t last_time;   // 帧结束的时间(微秒)
+};
+
+// 压缩写入器：包装实际写文件的 LogWriter
+class CompressingWriter : public LogWriter
+{
+public:
+    // level 为 zlib 的压缩级别，日志线程上默认用最快的 1
+    CompressingWriter(std::unique_ptr<LogWriter> file, const std::string &index_name, int level = 1);
+    ~CompressingWriter();
+
+    bool append(const char *line, const size_t len) override;
+    // 结束当前帧，把压缩数据和索引写入文件
+    bool flush() override;
+    bool sync() override;
+
+private:
+    // 把压缩输出写入文件，finish 为 true 时结束当前帧
+    bool deflateInput(const char *data, size_t len, bool finish);
+
+    struct Stream;
+    std::unique_ptr<LogWriter> file_;
+    std::unique_ptr<Stream> stream_; // zlib 的压缩状态
+    FILE *index_;                    // 帧索引文件
+    bool ok_;                        // 压缩器是否可用
+    FrameIndexEntry frame_;          // 当前帧
+    std::vector<char> out_;          // 压缩输出的缓冲区
+};
+
+// 读取边写边压缩的日志文件
+class CompressedLogReader : noncopyable
+{
+public:
+    explicit CompressedLogReader(const std::string &file_name);
+    ~CompressedLogReader();
+
+    // 文件和索引是否都已经打开
+    bool valid() const { return fd_ >= 0 && !frames_.empty(); }
+    const std::vector<FrameIndexEntry> &frames() const { return frames_; }
+
+    // 返回包含解压后偏移 raw_offset 的帧，没有时返回 -1
+    int findByOffset(uint64_t raw_offset) const;
+    // 返回第一个结束时间不早于 time 的帧，没有时返回 -1
+    int findByTime(int64_t time) const;
+    // 解压第 index 帧
+    bool readFrame(int index, std::string *out) const;
+
+private:
+    int fd_;
+    std::vector<FrameIndexEntry> frames_;
+};
@@ -0,0 +1,67 @@
+#include "currentthread.h"
+#include "logstream.h"
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace CurrentThread
+{
+thread_local int t_cached_tid = 0;
+thread_local char t_tid_string[48] = {0};
+thread_local int t_tid_string_length = 0;
+thread_local char t_thread_name[32] = {0};
+thread_local int t_thread_name_length = 0;
+
+// 重新生成格式化好的字符串
+static void formatTid()
+{
+    // 与 "%5d " 相同，线程id 不会是负数
+    char *p = t_tid_string;
+    p += convertPadded(p, static_cast<uint64_t>(t_cached_tid), 5, ' ');
+    *p++ = ' ';
+    if (t_thread_name[0] != '\0')
+    {
+        size_t len = strlen(t_thread_name);
+        memcpy(p, t_thread_name, len);
+        p += len;
+        *p++ = ' ';
+    }
+    *p = '\0';
+    t_tid_string_length = static_cast<int>(p - t_tid_string);
+}
+
+void cacheTid()
+{
+    t_cached_tid = static_cast<int>(::syscall(SYS_gettid));
+    formatTid();
+}
+
+void setName(const char *name)
+{
+    snprintf(t_thread_name, sizeof(t_thread_name), "%s", name ? name : "");
+    t_thread_name_length = static_cast<int>(strlen(t_thread_name));
+    tid();
+    formatTid();
+}
+
+namespace
+{
+// fork() 之后子进程中只剩调用 fork 的线程，它的线程id已经改变，需要重新获取
+void afterForkInChild()
+{
+    t_cached_tid = 0;
+    cacheTid();
+}
+
+// 程序启动时注册 fork 回调
+struct ForkInitializer
+{
+    ForkInitializer() { ::pthread_atfork(nullptr, nullptr, &afterForkInChild); }
+};
+ForkInitializer g_fork_initializer;
+} // namespace
+} // namespace CurrentThread
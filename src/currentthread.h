@@ -0,0 +1,47 @@
+#pragma once
+
+/**
+ * 当前线程信息，缓存在线程局部存储中
+ * 避免每条日志都调用 syscall(SYS_gettid) 和 snprintf
+ */
+namespace CurrentThread
+{
+extern thread_local int t_cached_tid;       // 线程id，0 表示尚未缓存
+extern thread_local char t_tid_string[48];  // 格式化好的线程id(和线程名)
+extern thread_local int t_tid_string_length; // t_tid_string 的长度
+extern thread_local char t_thread_name[32]; // 线程名，空串表示未设置
+extern thread_local int t_thread_name_length; // 线程名的长度
+
+// 获取并缓存线程id
+void cacheTid();
+
+// 返回线程id
+inline int tid()
+{
+    if (__builtin_expect(t_cached_tid == 0, 0))
+    {
+        cacheTid();
+    }
+    return t_cached_tid;
+}
+
+// 返回格式化好的线程id，例如 " 1234 " 或 " 1234 worker "
+inline const char *tidString()
+{
+    tid();
+    return t_tid_string;
+}
+
+inline int tidStringLength()
+{
+    tid();
+    return t_tid_string_length;
+}
+
+// 设置当前线程名，会输出在线程id之后
+void setName(const char *name);
+
+// 返回当前线程名
+inline const char *name() { return t_thread_name; }
+inline int nameLength() { return t_thread_name_length; }
+} // namespace CurrentThread
@@ -0,0 +1,166 @@
+#include "deferredlog.h"
+
+// 从 args 处解码一个 type 类型的参数并格式化，返回下一个参数的位置。数据不完整时返回 nullptr
+static const char *formatArg(uint8_t type, const char *args, const char *end, LogStream &stream)
+{
+    switch (type)
+    {
+    case kArgBool:
+    case kArgChar:
+        if (end - args < 1)
+        {
+            return nullptr;
+        }
+        if (type == kArgBool)
+        {
+            stream << (*args != 0);
+        }
+        else
+        {
+            stream << *args;
+        }
+        return args + 1;
+    case kArgInt32:
+    case kArgUInt32:
+    {
+        if (end - args < 4)
+        {
+            return nullptr;
+        }
+        uint32_t v;
+        memcpy(&v, args, sizeof(v));
+        if (type == kArgInt32)
+        {
+            stream << static_cast<int32_t>(v);
+        }
+        else
+        {
+            stream << v;
+        }
+        return args + 4;
+    }
+    case kArgInt64:
+    case kArgUInt64:
+    {
+        if (end - args < 8)
+        {
+            return nullptr;
+        }
+        uint64_t v;
+        memcpy(&v, args, sizeof(v));
+        if (type == kArgInt64)
+        {
+            stream << static_cast<long long>(v);
+        }
+        else
+        {
+            stream << static_cast<unsigned long long>(v);
+        }
+        return args + 8;
+    }
+    case kArgDouble:
+    {
+        if (end - args < 8)
+        {
+            return nullptr;
+        }
+        double v;
+        memcpy(&v, args, sizeof(v));
+        stream << v;
+        return args + 8;
+    }
+    case kArgString:
+    {
+        uint32_t len;
+        if (end - args < 4)
+        {
+            return nullptr;
+        }
+        memcpy(&len, args, sizeof(len));
+        args += sizeof(len);
+        if (static_cast<uint32_t>(end - args) < len)
+        {
+            return nullptr;
+        }
+        stream.append(args, static_cast<int>(len));
+        return args + len;
+    }
+    case kArgPointer:
+    {
+        if (end - args < static_cast<long>(sizeof(uintptr_t)))
+        {
+            return nullptr;
+        }
+        uintptr_t v;
+        memcpy(&v, args, sizeof(v));
+        stream << reinterpret_cast<const void *>(v);
+        return args + sizeof(v);
+    }
+    default:
+        return nullptr;
+    }
+}
+
+void formatDeferredMessage(const LogDescriptor &desc, const char *args, const char *end, LogStream &stream)
+{
+    const char *f = desc.format;
+    const char *literal = f; // 尚未输出的普通字符的起始位置
+    int index = 0;           // 下一个参数的序号
+    while (*f)
+    {
+        if ((f[0] == '{' && f[1] == '{') || (f[0] == '}' && f[1] == '}'))
+        {
+            // 转义的花括号只输出一个
+            stream.append(literal, static_cast<int>(f + 1 - literal));
+            f += 2;
+            literal = f;
+        }
+        else if (f[0] == '{' && f[1] == '}')
+        {
+            stream.append(literal, static_cast<int>(f - literal));
+            if (index < desc.num_args && args)
+            {
+                args = formatArg(desc.arg_types[index], args, end, stream);
+            }
+            else
+            {
+                // 参数个数少于占位符个数，原样输出
+                stream.append("{}", 2);
+            }
+            ++index;
+            f += 2;
+            literal = f;
+        }
+        else
+        {
+            ++f;
+        }
+    }
+    stream.append(literal, static_cast<int>(f - literal));
+}
+
+void formatDeferredRecord(const char *data, int len, int64_t time, LogStream &stream)
+{
+    if (len < kDeferredHeaderSize)
+    {
+        return;
+    }
+    const LogDescriptor *desc;
+    int tid;
+    memcpy(&desc, data, sizeof(desc));
+    memcpy(&tid, data + sizeof(desc), sizeof(tid));
+    // 调用者的线程名
+    int name_len = static_cast<unsigned char>(data[kDeferredHeaderSize - 1]);
+    if (name_len >= 32 || len < kDeferredHeaderSize + name_len)
+    {
+        return;
+    }
+    char name[32];
+    memcpy(name, data + kDeferredHeaderSize, name_len);
+    name[name_len] = '\0';
+
+    // 与调用者线程中的 Logger 使用相同的日志头和结尾
+    Logger::beginRecord(stream, time, tid, name, desc->level, desc->file, desc->line, desc->func);
+    formatDeferredMessage(*desc, data + kDeferredHeaderSize + name_len, data + len, stream);
+    Logger::finishRecord(stream);
+}
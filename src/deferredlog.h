@@ -0,0 +1,281 @@
+#pragma once
+
+#include "logger.h"
+#include "timestamp.h"
+#include "currentthread.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+/**
+ * 延迟格式化的日志
+ * 调用点只注册一次静态描述信息(文件、行号、级别、格式串、参数类型)，
+ * 热路径上只把参数的原始字节和时间戳复制到当前线程的暂存队列中，由日志线程完成格式化。
+ * 格式串中用 {} 表示参数，{{ 和 }} 表示花括号本身
+ *
+ * 用法：
+ *     LOG_SET_ASYNC_STAGING(1)
+ *     LOG_INFO_DEFER("order {} filled at {}", id, price);
+ */
+
+// 参数类型
+enum DeferredArgType : uint8_t
+{
+    kArgBool,
+    kArgChar,
+    kArgInt32,
+    kArgUInt32,
+    kArgInt64,
+    kArgUInt64,
+    kArgDouble,
+    kArgString, // 4字节长度 + 内容
+    kArgPointer,
+};
+
+// 调用点的静态描述信息
+struct LogDescriptor
+{
+    LogDescriptor(const char *file, int line, Logger::LogLevel level, const char *func,
+                  const char *format, const uint8_t *arg_types, int num_args, const LogLevelSlot &slot)
+        : file(file), line(line), level(level), func(func), format(format), arg_types(arg_types), num_args(num_args),
+          slot(slot)
+    {
+    }
+
+    Logger::SourceFile file;  // 文件名(只在注册时计算一次)
+    int line;                 // 行号
+    Logger::LogLevel level;   // 日志级别
+    const char *func;         // 函数名
+    const char *format;       // 格式串
+    const uint8_t *arg_types; // 参数类型 DeferredArgType
+    int num_args;             // 参数个数
+    const LogLevelSlot &slot; // 所在源文件的级别 slot
+};
+
+// 记录内容：描述信息指针 + 线程id + 线程名长度(1字节) + 线程名 + 参数
+const int kDeferredHeaderSize = static_cast<int>(sizeof(const LogDescriptor *) + sizeof(int) + 1);
+
+// 当前线程的记录头长度
+inline int deferredHeaderSize()
+{
+    return kDeferredHeaderSize + CurrentThread::nameLength();
+}
+
+/**
+ * 参数类型萃取：类型、编码长度和编码方法
+ * 不支持的类型在编译时报错
+ */
+template <class T, class Enable = void>
+struct DeferredArg;
+
+template <>
+struct DeferredArg<bool>
+{
+    static const uint8_t kType = kArgBool;
+    static int size(bool) { return 1; }
+    static char *encode(char *p, bool v)
+    {
+        *p = v ? 1 : 0;
+        return p + 1;
+    }
+};
+
+template <>
+struct DeferredArg<char>
+{
+    static const uint8_t kType = kArgChar;
+    static int size(char) { return 1; }
+    static char *encode(char *p, char v)
+    {
+        *p = v;
+        return p + 1;
+    }
+};
+
+// 整数：不超过4字节的按4字节保存，其余按8字节保存
+template <class T>
+struct DeferredArg<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                                              !std::is_same<T, char>::value>::type>
+{
+    using Stored = typename std::conditional<
+        sizeof(T) <= 4,
+        typename std::conditional<std::is_signed<T>::value, int32_t, uint32_t>::type,
+        typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type>::type;
+    static const uint8_t kType = sizeof(T) <= 4 ? (std::is_signed<T>::value ? kArgInt32 : kArgUInt32)
+                                                : (std::is_signed<T>::value ? kArgInt64 : kArgUInt64);
+    static int size(T) { return sizeof(Stored); }
+    static char *encode(char *p, T v)
+    {
+        Stored stored = static_cast<Stored>(v);
+        memcpy(p, &stored, sizeof(stored));
+        return p + sizeof(stored);
+    }
+};
+
+template <class T>
+struct DeferredArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static const uint8_t kType = kArgDouble;
+    static int size(T) { return sizeof(double); }
+    static char *encode(char *p, T v)
+    {
+        double stored = static_cast<double>(v);
+        memcpy(p, &stored, sizeof(stored));
+        return p + sizeof(stored);
+    }
+};
+
+// 字符串：调用者的内存在日志线程格式化时可能已经失效，必须复制内容
+inline char *encodeDeferredString(char *p, const char *str, uint32_t len)
+{
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), str, len);
+    return p + sizeof(len) + len;
+}
+
+template <>
+struct DeferredArg<const char *>
+{
+    static const uint8_t kType = kArgString;
+    static int size(const char *v) { return static_cast<int>(sizeof(uint32_t) + (v ? strlen(v) : 6)); }
+    static char *encode(char *p, const char *v)
+    {
+        return v ? encodeDeferredString(p, v, static_cast<uint32_t>(strlen(v))) : encodeDeferredString(p, "(null)", 6);
+    }
+};
+
+template <>
+struct DeferredArg<char *> : DeferredArg<const char *>
+{
+};
+
+template <>
+struct DeferredArg<std::string>
+{
+    static const uint8_t kType = kArgString;
+    static int size(const std::string &v) { return static_cast<int>(sizeof(uint32_t) + v.size()); }
+    static char *encode(char *p, const std::string &v)
+    {
+        return encodeDeferredString(p, v.data(), static_cast<uint32_t>(v.size()));
+    }
+};
+
+// 其他指针按地址输出
+template <class T>
+struct DeferredArg<T *, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+    static const uint8_t kType = kArgPointer;
+    static int size(const T *) { return sizeof(uintptr_t); }
+    static char *encode(char *p, const T *v)
+    {
+        uintptr_t stored = reinterpret_cast<uintptr_t>(v);
+        memcpy(p, &stored, sizeof(stored));
+        return p + sizeof(stored);
+    }
+};
+
+// 每种参数类型组合对应的类型表
+template <class... Args>
+struct DeferredArgTypes
+{
+    static constexpr uint8_t kTypes[sizeof...(Args) + 1] = {DeferredArg<Args>::kType..., 0};
+};
+template <class... Args>
+constexpr uint8_t DeferredArgTypes<Args...>::kTypes[sizeof...(Args) + 1];
+
+// 把描述信息、线程id、线程名和参数编码到 p 处
+template <class... Args>
+void encodeDeferred(char *p, const LogDescriptor &desc, const Args &...args)
+{
+    const LogDescriptor *ptr = &desc;
+    memcpy(p, &ptr, sizeof(ptr));
+    p += sizeof(ptr);
+    int tid = CurrentThread::tid();
+    memcpy(p, &tid, sizeof(tid));
+    p += sizeof(tid);
+    int name_len = CurrentThread::nameLength();
+    *p++ = static_cast<char>(name_len);
+    memcpy(p, CurrentThread::name(), name_len);
+    p += name_len;
+    // 按参数顺序依次编码
+    int expand[] = {0, (p = DeferredArg<Args>::encode(p, args), 0)...};
+    (void)expand;
+}
+
+// 日志线程调用：把一条延迟日志记录格式化为完整的一行，与 LOG_INFO 输出的记录格式相同；stream 应为新建的流
+void formatDeferredRecord(const char *data, int len, int64_t time, LogStream &stream);
+// 只格式化消息部分(不含日志头)
+void formatDeferredMessage(const LogDescriptor &desc, const char *args, const char *end, LogStream &stream);
+
+// 无法写入暂存队列时(同步日志、队列已满、消息过长)在当前线程格式化
+template <class... Args>
+void logDeferredSync(const LogDescriptor &desc, int len, const Args &...args)
+{
+    // 与 LOG_DEBUG 等宏一样按源文件的级别判断，否则设置了模块级别的日志只会写入飞行记录器
+    Logger logger(desc.file, desc.line, desc.level, desc.func, desc.slot);
+    // 编码后立即在当前线程格式化，很长的参数使用堆上的内存
+    char stack_buf[kSmallBuffer];
+    std::unique_ptr<char[]> heap_buf(len > kSmallBuffer ? new char[len] : nullptr);
+    char *buf = heap_buf ? heap_buf.get() : stack_buf;
+    encodeDeferred(buf, desc, args...);
+    formatDeferredMessage(desc, buf + deferredHeaderSize(), buf + len, logger.stream());
+}
+
+// 热路径：只复制参数的原始字节
+template <class... Args>
+void logDeferred(const LogDescriptor &desc, const Args &...args)
+{
+    int len = deferredHeaderSize();
+    int sizes[] = {0, (len += DeferredArg<Args>::size(args), 0)...};
+    (void)sizes;
+
+    AsyncLogging *async = Logger::asyncLogging();
+    // 只写入飞行记录器的日志，以及需要先输出飞行记录器中上下文的 ERROR/FATAL，由 Logger 在当前线程处理
+    if (async && len <= kSmallBuffer && desc.level < Logger::ERROR &&
+        !Logger::Impl::isRecorded(desc.level, desc.slot.logLevel()))
+    {
+        char *dest = async->reserve(len);
+        if (dest)
+        {
+            encodeDeferred(dest, desc, args...);
+            async->commit(len, Timestamp::now(), StagingRing::kDeferred, desc.level);
+            return;
+        }
+    }
+    logDeferredSync(desc, len, args...);
+}
+
+/**
+ * 用户调用的宏
+ * 每个调用点展开为一个独立的 lambda，其中的静态变量就是该调用点的描述信息，只初始化一次
+ * 级别的判断与 LOG_DEBUG 等宏相同：按调用点所在源文件的级别判断(WARN 及以上总是输出)，
+ * 所属 slot 同样只在第一次执行时查找，低于源文件级别的日志写入飞行记录器
+ * 低于 DDLOG_COMPILE_LEVEL 的级别不生成代码
+ */
+#define LOG_DEFER(level, fmt, ...)                                                                       \
+    do                                                                                                   \
+    {                                                                                                    \
+        if constexpr (static_cast<int>(level) >= DDLOG_COMPILE_LEVEL)                                    \
+        {                                                                                                \
+            static LogLevelSlot &ddlog_slot = Logger::fileLevelSlot(__FILE__);                           \
+            if (level >= Logger::WARN || ddlog_slot.enabled(level))                                      \
+            {                                                                                            \
+                [](const char *ddlog_func, const auto &...ddlog_args) {                                  \
+                    static const LogDescriptor ddlog_desc(                                               \
+                        __FILE__, __LINE__, level, ddlog_func, fmt,                                      \
+                        DeferredArgTypes<typename std::decay<decltype(ddlog_args)>::type...>::kTypes,    \
+                        static_cast<int>(sizeof...(ddlog_args)), ddlog_slot);                            \
+                    logDeferred<typename std::decay<decltype(ddlog_args)>::type...>(ddlog_desc, ddlog_args...); \
+                }(__func__, ##__VA_ARGS__);                                                              \
+            }                                                                                            \
+        }                                                                                                \
+    } while (0)
+
+#define LOG_TRACE_DEFER(fmt, ...) LOG_DEFER(Logger::TRACE, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG_DEFER(fmt, ...) LOG_DEFER(Logger::DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO_DEFER(fmt, ...) LOG_DEFER(Logger::INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARN_DEFER(fmt, ...) LOG_DEFER(Logger::WARN, fmt, ##__VA_ARGS__)
+#define LOG_ERROR_DEFER(fmt, ...) LOG_DEFER(Logger::ERROR, fmt, ##__VA_ARGS__)
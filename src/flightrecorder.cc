@@ -0,0 +1,214 @@
+#include "flightrecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace
+{
+// 单条日志的最大长度(超过时截断)，不小于 Logger 的 kSmallBuffer
+const size_t kMaxRecord = 4096;
+// 截断时在末尾预留的截断标记的空间
+const size_t kTruncateReserve = 48;
+
+// 新线程的缓冲区大小，0 表示关闭
+std::atomic<size_t> g_capacity(0);
+
+// 所有线程的记录器，线程退出时移除；使用固定大小的数组，崩溃时不加锁读取
+const int kMaxRecorders = 256;
+std::atomic<FlightRecorder *> g_recorders[kMaxRecorders];
+
+// 线程局部的记录器：线程退出时从注册表中移除
+struct LocalRecorder
+{
+    std::shared_ptr<FlightRecorder> recorder;
+
+    ~LocalRecorder()
+    {
+        if (recorder)
+        {
+            for (auto &slot : g_recorders)
+            {
+                FlightRecorder *expected = recorder.get();
+                if (slot.compare_exchange_strong(expected, nullptr))
+                {
+                    break;
+                }
+            }
+        }
+    }
+};
+thread_local LocalRecorder t_local_recorder;
+} // namespace
+
+FlightRecorder::FlightRecorder(size_t capacity)
+    : buffer_(std::max(capacity, sizeof(RecordHeader) + kMaxRecord)),
+      head_(0),
+      tail_(0),
+      count_(0)
+{
+}
+
+void FlightRecorder::copyIn(uint64_t pos, const void *data, size_t len)
+{
+    size_t offset = static_cast<size_t>(pos % buffer_.size());
+    size_t first = std::min(len, buffer_.size() - offset);
+    memcpy(&buffer_[offset], data, first);
+    memcpy(&buffer_[0], static_cast<const char *>(data) + first, len - first);
+}
+
+void FlightRecorder::copyOut(uint64_t pos, void *data, size_t len) const
+{
+    size_t offset = static_cast<size_t>(pos % buffer_.size());
+    size_t first = std::min(len, buffer_.size() - offset);
+    memcpy(data, &buffer_[offset], first);
+    memcpy(static_cast<char *>(data) + first, &buffer_[0], len - first);
+}
+
+int FlightRecorder::record(const char *data, int len, int level)
+{
+    RecordHeader header;
+    header.len = static_cast<uint32_t>(len);
+    header.level = static_cast<uint32_t>(level);
+    // 太长的日志保留开头，再加上截断标记(代替原来的换行符)
+    char marker[kTruncateReserve];
+    int marker_len = 0;
+    int truncated = 0;
+    if (static_cast<size_t>(len) > kMaxRecord)
+    {
+        size_t kept = kMaxRecord - kTruncateReserve;
+        truncated = len - static_cast<int>(kept);
+        marker_len = snprintf(marker, sizeof(marker), " ...(truncated %d bytes)\n", truncated);
+        header.len = static_cast<uint32_t>(kept + marker_len);
+    }
+    uint64_t size = sizeof(header) + header.len;
+    // 丢弃最旧的日志，直到放得下
+    while (head_ + size - tail_ > buffer_.size())
+    {
+        RecordHeader oldest;
+        copyOut(tail_, &oldest, sizeof(oldest));
+        tail_ += sizeof(oldest) + oldest.len;
+        --count_;
+    }
+    copyIn(head_, &header, sizeof(header));
+    copyIn(head_ + sizeof(header), data, header.len - marker_len);
+    copyIn(head_ + sizeof(header) + header.len - marker_len, marker, marker_len);
+    head_ += size;
+    ++count_;
+    return truncated;
+}
+
+int FlightRecorder::drain(const OutputFunc &output)
+{
+    char record[kMaxRecord];
+    int drained = 0;
+    while (tail_ < head_)
+    {
+        RecordHeader header;
+        copyOut(tail_, &header, sizeof(header));
+        copyOut(tail_ + sizeof(header), record, header.len);
+        tail_ += sizeof(header) + header.len;
+        output(record, static_cast<int>(header.len), static_cast<int>(header.level));
+        ++drained;
+    }
+    count_ = 0;
+    return drained;
+}
+
+void FlightRecorder::setCapacity(size_t capacity)
+{
+    g_capacity.store(capacity, std::memory_order_relaxed);
+}
+
+FlightRecorder *FlightRecorder::local()
+{
+    LocalRecorder &local = t_local_recorder;
+    if (!local.recorder)
+    {
+        size_t capacity = g_capacity.load(std::memory_order_relaxed);
+        if (capacity == 0)
+        {
+            return nullptr;
+        }
+        // 第一次使用：创建并注册
+        local.recorder = std::make_shared<FlightRecorder>(capacity);
+        // 超过 kMaxRecorders 个线程时，之后的线程崩溃时不输出
+        for (auto &slot : g_recorders)
+        {
+            FlightRecorder *expected = nullptr;
+            if (slot.compare_exchange_strong(expected, local.recorder.get()))
+            {
+                break;
+            }
+        }
+    }
+    return local.recorder.get();
+}
+
+bool FlightRecorder::writeOut(int fd, uint64_t pos, size_t len) const
+{
+    // 跨越缓冲区末尾时分两次写
+    size_t offset = static_cast<size_t>(pos % buffer_.size());
+    size_t first = std::min(len, buffer_.size() - offset);
+    const char *parts[2] = {&buffer_[offset], &buffer_[0]};
+    size_t sizes[2] = {first, len - first};
+    for (int i = 0; i < 2; ++i)
+    {
+        const char *data = parts[i];
+        size_t left = sizes[i];
+        while (left > 0)
+        {
+            ssize_t n = ::write(fd, data, left);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            data += n;
+            left -= static_cast<size_t>(n);
+        }
+    }
+    return true;
+}
+
+int FlightRecorder::dumpForCrash(int fd) const
+{
+    int dumped = 0;
+    for (uint64_t pos = tail_; pos < head_;)
+    {
+        RecordHeader header;
+        copyOut(pos, &header, sizeof(header));
+        pos += sizeof(header);
+        if (header.len > kMaxRecord || pos + header.len > head_)
+        {
+            // 所属线程正在写入，剩下的内容不完整
+            break;
+        }
+        if (!writeOut(fd, pos, header.len))
+        {
+            break;
+        }
+        pos += header.len;
+        ++dumped;
+    }
+    return dumped;
+}
+
+int FlightRecorder::dumpAllForCrash(int fd)
+{
+    int dumped = 0;
+    for (auto &slot : g_recorders)
+    {
+        if (FlightRecorder *recorder = slot.load(std::memory_order_acquire))
+        {
+            dumped += recorder->dumpForCrash(fd);
+        }
+    }
+    return dumped;
+}
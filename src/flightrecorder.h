@@ -0,0 +1,65 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <functional>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * 飞行记录器：每个线程一个固定大小的环形缓冲区，保存最近的低级别日志(已经格式化好的文本)
+ * 正常情况下这些日志不写入文件；发生 ERROR/FATAL 或者崩溃时再把它们输出，作为出错前的上下文
+ * 空间不足时覆盖最旧的日志。只有所属线程写入，崩溃时其他线程的读取是尽力而为的
+ */
+class FlightRecorder : noncopyable
+{
+public:
+    // 输出一条日志：内容、长度、级别
+    using OutputFunc = std::function<void(const char *, int, int)>;
+
+    // 容量至少能放下一条最长的日志
+    explicit FlightRecorder(size_t capacity);
+
+    /**
+     * 写入一条日志，空间不足时丢弃最旧的日志
+     * 超过 4096 字节的日志只保留开头，末尾注明 " ...(truncated N bytes)"，返回截断的字节数
+     */
+    int record(const char *data, int len, int level);
+    // 按从旧到新的顺序输出所有日志并清空，返回条数
+    int drain(const OutputFunc &output);
+    // 当前保存的日志条数
+    int count() const { return count_; }
+
+    // 设置新线程的缓冲区大小，0 表示关闭(已经创建的缓冲区不受影响)
+    static void setCapacity(size_t capacity);
+    // 返回当前线程的记录器，第一次调用时创建并注册；未开启时返回 nullptr
+    static FlightRecorder *local();
+    /**
+     * 崩溃处理使用：把所有线程的记录器按线程依次 write(2) 到 fd，返回条数
+     * 只使用异步信号安全的操作：不加锁、不分配内存，也不修改记录器
+     */
+    static int dumpAllForCrash(int fd);
+
+private:
+    // 记录头
+    struct RecordHeader
+    {
+        uint32_t len;   // 日志内容长度
+        uint32_t level; // 日志级别
+    };
+
+    // 在环形缓冲区的逻辑位置 pos 处写入/读取，会跨越缓冲区末尾
+    void copyIn(uint64_t pos, const void *data, size_t len);
+    void copyOut(uint64_t pos, void *data, size_t len) const;
+    // 把逻辑位置 pos 处的 len 字节写到 fd
+    bool writeOut(int fd, uint64_t pos, size_t len) const;
+    // 写出自己的所有日志，返回条数
+    int dumpForCrash(int fd) const;
+
+    std::vector<char> buffer_;
+    uint64_t head_; // 下一条日志的写入位置(逻辑位置，单调递增)
+    uint64_t tail_; // 最旧的日志的位置
+    int count_;     // 日志条数
+};
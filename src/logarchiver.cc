@@ -0,0 +1,307 @@
+#include "logarchiver.h"
+#include "timestamp.h"
+
+#include <algorithm>
+#include <vector>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#ifdef DDLOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+// 压缩时每次读取的大小
+const size_t kChunkSize = 256 * 1024;
+
+bool endsWith(const std::string &s, const char *suffix)
+{
+    size_t len = strlen(suffix);
+    return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+// 降低当前线程的 CPU 和 IO 优先级
+void lowerPriority()
+{
+    pid_t tid = static_cast<pid_t>(::syscall(SYS_gettid));
+    ::setpriority(PRIO_PROCESS, static_cast<id_t>(tid), 19);
+    // ioprio_set(IOPRIO_WHO_PROCESS, tid, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0))
+    const int kIoprioWhoProcess = 1;
+    const int kIoprioClassIdle = 3;
+    const int kIoprioClassShift = 13;
+    ::syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, kIoprioClassIdle << kIoprioClassShift);
+}
+} // namespace
+
+LogArchiver::LogArchiver(const std::string &dir, const std::string &prefix, const LogFileOptions &options)
+    : dir_(dir),
+      prefix_(prefix),
+      options_(options),
+      running_(true),
+      thread_(&LogArchiver::threadFunc, this)
+{
+#ifndef DDLOG_HAVE_ZLIB
+    if (options_.compress)
+    {
+        fprintf(stderr, "LogArchiver: built without zlib, rolled files are not compressed\n");
+    }
+#endif
+}
+
+LogArchiver::~LogArchiver()
+{
+    {
+        std::unique_lock<std::mutex> guard(mutex_);
+        running_ = false;
+    }
+    cond_.notify_one();
+    thread_.join();
+}
+
+void LogArchiver::opened(const std::string &file_name)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    open_.insert(file_name);
+}
+
+void LogArchiver::renamed(const std::string &from, const std::string &to)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    open_.erase(from);
+    open_.insert(to);
+}
+
+void LogArchiver::closed(const std::string &file_name)
+{
+    {
+        std::unique_lock<std::mutex> guard(mutex_);
+        open_.erase(file_name);
+        pending_.push_back(file_name);
+    }
+    cond_.notify_one();
+}
+
+void LogArchiver::threadFunc()
+{
+    ::pthread_setname_np(::pthread_self(), "LogArchiver");
+    lowerPriority();
+
+    std::unique_lock<std::mutex> guard(mutex_);
+    for (;;)
+    {
+        cond_.wait(guard, [this] { return !running_ || !pending_.empty(); });
+        if (!running_)
+        {
+            break;
+        }
+        std::string file_name = pending_.front();
+        pending_.pop_front();
+        guard.unlock();
+
+#ifdef DDLOG_HAVE_ZLIB
+        // 写入时已经压缩的文件不再压缩
+        if (options_.compress && !endsWith(file_name, ".gz"))
+        {
+            compress(file_name);
+        }
+#endif
+        enforceRetention();
+
+        guard.lock();
+    }
+}
+
+bool LogArchiver::compress(const std::string &file_name)
+{
+#ifdef DDLOG_HAVE_ZLIB
+    int fd = ::open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        // 可能已经被清理
+        return false;
+    }
+    // 先写入临时文件，完成后再改名，避免留下不完整的 .gz
+    std::string gz_name = file_name + ".gz";
+    std::string tmp_name = gz_name + ".tmp";
+    gzFile gz = ::gzopen(tmp_name.c_str(), "wb6");
+    if (gz == nullptr)
+    {
+        ::close(fd);
+        fprintf(stderr, "LogArchiver gzopen %s failed\n", tmp_name.c_str());
+        return false;
+    }
+
+    std::vector<char> chunk(kChunkSize);
+    bool ok = true;
+    for (;;)
+    {
+        int64_t start = Timestamp::monotonicNanos();
+        ssize_t n = ::read(fd, chunk.data(), chunk.size());
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+        if (::gzwrite(gz, chunk.data(), static_cast<unsigned>(n)) != n)
+        {
+            ok = false;
+            break;
+        }
+        throttle(Timestamp::monotonicNanos() - start, static_cast<size_t>(n));
+
+        std::unique_lock<std::mutex> guard(mutex_);
+        if (!running_)
+        {
+            // 正在退出：放弃这个文件
+            ok = false;
+            break;
+        }
+    }
+    ::close(fd);
+    if (::gzclose(gz) != Z_OK)
+    {
+        ok = false;
+    }
+    if (!ok || ::rename(tmp_name.c_str(), gz_name.c_str()) != 0)
+    {
+        ::unlink(tmp_name.c_str());
+        return false;
+    }
+    ::unlink(file_name.c_str());
+    return true;
+#else
+    (void)file_name;
+    return false;
+#endif
+}
+
+void LogArchiver::throttle(int64_t work_ns, size_t bytes)
+{
+    int64_t sleep_ns = 0;
+    // CPU 比例：工作 work_ns 之后休眠 work_ns * (100 - p) / p
+    int percent = options_.compress_cpu_percent;
+    if (percent > 0 && percent < 100)
+    {
+        sleep_ns = work_ns * (100 - percent) / percent;
+    }
+    // IO 速率：处理 bytes 字节至少需要 bytes / rate 秒
+    if (options_.compress_bytes_per_sec > 0)
+    {
+        int64_t min_ns = static_cast<int64_t>(bytes * 1000000000.0 / options_.compress_bytes_per_sec);
+        sleep_ns = std::max(sleep_ns, min_ns - work_ns);
+    }
+    if (sleep_ns > 0)
+    {
+        // 退出时立即醒来
+        std::unique_lock<std::mutex> guard(mutex_);
+        cond_.wait_for(guard, std::chrono::nanoseconds(sleep_ns), [this] { return !running_; });
+    }
+}
+
+void LogArchiver::enforceRetention()
+{
+    if (options_.max_files <= 0 && options_.max_total_bytes <= 0)
+    {
+        return;
+    }
+
+    struct Entry
+    {
+        std::string name;
+        off_t size;
+        struct timespec mtime;
+    };
+    std::vector<Entry> entries;
+    DIR *dir = ::opendir(dir_.c_str());
+    if (dir == nullptr)
+    {
+        return;
+    }
+    std::set<std::string> open_files;
+    {
+        std::unique_lock<std::mutex> guard(mutex_);
+        open_files = open_;
+    }
+    while (struct dirent *entry = ::readdir(dir))
+    {
+        std::string name(entry->d_name);
+        if (name.compare(0, prefix_.size(), prefix_) != 0 || !(endsWith(name, ".log") || endsWith(name, ".log.gz")))
+        {
+            continue;
+        }
+        std::string path = dir_ + name;
+        struct stat st;
+        // 跳过指向当前文件的符号链接和正在写的文件
+        if (::lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || open_files.count(path))
+        {
+            continue;
+        }
+        entries.push_back(Entry{path, st.st_size, st.st_mtim});
+    }
+    ::closedir(dir);
+
+    // 最旧的在前
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        if (a.mtime.tv_sec != b.mtime.tv_sec)
+        {
+            return a.mtime.tv_sec < b.mtime.tv_sec;
+        }
+        if (a.mtime.tv_nsec != b.mtime.tv_nsec)
+        {
+            return a.mtime.tv_nsec < b.mtime.tv_nsec;
+        }
+        return a.name < b.name;
+    });
+    // 正在写的文件也计入数量和总大小
+    size_t count = entries.size() + open_files.size();
+    off_t total = 0;
+    for (const auto &entry : entries)
+    {
+        total += entry.size;
+    }
+    for (const auto &name : open_files)
+    {
+        struct stat st;
+        if (::stat(name.c_str(), &st) == 0)
+        {
+            total += st.st_size;
+        }
+    }
+
+    for (const auto &entry : entries)
+    {
+        bool too_many = options_.max_files > 0 && count > static_cast<size_t>(options_.max_files);
+        bool too_large = options_.max_total_bytes > 0 && total > options_.max_total_bytes;
+        if (!too_many && !too_large)
+        {
+            break;
+        }
+        // 其他进程(例如同一程序的另一个实例)正在写的文件持有共享锁，拿不到排它锁时跳过，仍计入数量和总大小
+        int fd = ::open(entry.name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if (::flock(fd, LOCK_EX | LOCK_NB) == 0 && ::unlink(entry.name.c_str()) == 0)
+        {
+            --count;
+            total -= entry.size;
+            // 写入时压缩的文件的帧索引
+            ::unlink((entry.name + ".idx").c_str());
+        }
+        ::close(fd);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "logfile.h"
+#include "noncopyable.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+/**
+ * 已经关闭的日志文件的后台处理：gzip 压缩和按数量、总大小清理
+ * 在一个低优先级(nice 19、IO 空闲类)的线程中运行，按 CPU 比例和每秒字节数限速，
+ * 不与日志线程争抢资源。
+ * 清理时考虑日志目录中同一程序的所有日志文件(包括之前运行留下的)，从最旧的开始删除，
+ * 正在写的文件(包括同一程序的其他进程正在写的、持有 flock 的文件)不会被删除
+ */
+class LogArchiver : noncopyable
+{
+public:
+    // dir 为日志目录(以 / 结尾)，prefix 为日志文件名的前缀
+    LogArchiver(const std::string &dir, const std::string &prefix, const LogFileOptions &options);
+    // 放弃还没有开始的压缩任务，这些文件保持未压缩
+    ~LogArchiver();
+
+    // 文件已经打开：清理时跳过
+    void opened(const std::string &file_name);
+    // 正在写的文件改名
+    void renamed(const std::string &from, const std::string &to);
+    // 文件已经关闭：压缩，然后检查保留限制
+    void closed(const std::string &file_name);
+
+private:
+    void threadFunc();
+    // 把 file_name 压缩为 file_name.gz，成功后删除原文件
+    bool compress(const std::string &file_name);
+    // 按限速要求休眠：work_ns 为刚才工作的耗时，bytes 为刚才处理的字节数
+    void throttle(int64_t work_ns, size_t bytes);
+    // 删除最旧的文件，直到满足数量和总大小的限制
+    void enforceRetention();
+
+    const std::string dir_;
+    const std::string prefix_;
+    const LogFileOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::string> pending_; // 等待压缩的文件
+    std::set<std::string> open_;      // 正在写的文件
+    bool running_;
+    std::thread thread_; // 最后初始化
+};
@@ -1,15 +1,34 @@
 #include "logfile.h"
+#include "compressedlog.h"
+#include "logarchiver.h"
+#include "mmapwriter.h"
+#include "uringwriter.h"
 
+#include <atomic>
 #include <iostream>
 #include <time.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 
+// 日志时间的时区偏移(秒)，定义在 logger.cc 中
+extern std::atomic<int> g_time_zone_offset;
+
+void LogWriter::lockInUse(int fd)
+{
+    if (fd >= 0)
+    {
+        ::flock(fd, LOCK_SH | LOCK_NB);
+    }
+}
+
 // 写数据到缓冲区
-void FileWritter::append(const char *line, const size_t len)
+bool FileWritter::append(const char *line, const size_t len)
 {
+    bool ok = true;
     // 将line写入文件file_的缓冲区中，缓冲区的长度可能不足以写完当前数据 
     size_t n = ::fwrite(line, 1, len, file_);
     // 如果没写完要继续写
@@ -24,53 +43,311 @@ void FileWritter::append(const char *line, const size_t len)
             {
                 fprintf(stderr, "FileWritter::append() failed %d\n", err);
             }
+            ok = false;
             break;
         }
         n += x;
         remain -= x;
     }
-    written_bytes_ += len;
+    written_bytes_ += static_cast<off_t>(len);
+    return ok;
 }
 
-LogFile::LogFile(off_t roll_size)
+// 没有 zlib 时不能写入时压缩：退回未压缩的 .log 文件，避免把未压缩的数据写进 .log.gz
+static LogFileOptions checkOptions(const LogFileOptions &options)
+{
+    LogFileOptions checked = options;
+#ifndef DDLOG_HAVE_ZLIB
+    if (checked.inline_compress)
+    {
+        fprintf(stderr, "LogFile: built without zlib, inline_compress ignored, writing uncompressed .log files\n");
+        checked.inline_compress = false;
+    }
+#endif
+    return checked;
+}
+
+LogFile::LogFile(off_t roll_size, const LogFileOptions &options)
     : roll_size_(roll_size), // 日志文件的滚动大小
-      file_index_(0)
+      file_index_(0),
+      options_(checkOptions(options)),
+      next_roll_time_(0),
+      rolls_(0),
+      write_errors_(0),
+      next_index_(0),
+      retiring_(0),
+      helper_running_(options.preopen)
 {
     setBaseName();
+    if (options_.compress || options_.max_files > 0 || options_.max_total_bytes > 0)
+    {
+        archiver_.reset(new LogArchiver(log_dir_, process_name_ + ".", options_));
+    }
     rollFile();
+    if (options_.preopen)
+    {
+        helper_ = std::thread(&LogFile::helperThread, this);
+    }
+}
+
+LogFile::~LogFile()
+{
+    if (helper_.joinable())
+    {
+        {
+            std::unique_lock<std::mutex> guard(helper_mutex_);
+            helper_running_ = false;
+        }
+        helper_cond_.notify_one();
+        helper_.join();
+    }
+    // 预先打开但没有用到的文件
+    if (next_file_)
+    {
+        next_file_.reset();
+        ::unlink(next_name_.c_str());
+        if (options_.inline_compress)
+        {
+            ::unlink((next_name_ + ".idx").c_str());
+        }
+    }
+    // 当前文件不压缩，在 archiver_ 之前关闭
+    file_.reset();
 }
 
-LogFile::~LogFile() = default;
+bool LogFile::shouldRoll() const
+{
+    if (file_->writtenBytes() > roll_size_)
+    {
+        return true;
+    }
+    return options_.roll_period > 0 && ::time(nullptr) >= next_roll_time_;
+}
+
+std::unique_ptr<LogWriter> LogFile::makeWriter(const std::string &file_name)
+{
+    if (archiver_)
+    {
+        archiver_->opened(file_name);
+    }
+    std::unique_ptr<LogWriter> file;
+    if (options_.backend == FileBackend::kUring)
+    {
+        file.reset(new UringFileWriter(file_name));
+    }
+    else if (options_.backend == FileBackend::kMmap)
+    {
+        file.reset(new MmapFileWriter(file_name, roll_size_));
+    }
+    else
+    {
+        file.reset(new FileWritter(file_name));
+    }
+    if (options_.inline_compress)
+    {
+        file.reset(new CompressingWriter(std::move(file), file_name + ".idx", options_.inline_compress_level));
+    }
+    return file;
+}
 
 void LogFile::append(const char *line, const size_t len)
 {
     std::unique_lock<std::mutex> guard(mutex_);
-    file_->append(line, len);
-    if (file_->writtenBytes() > roll_size_)
+    if (!file_->append(line, len))
+    {
+        write_errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (shouldRoll())
+    {
+        rollFile();
+        rolls_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void LogFile::submit(const char *data, size_t len, void *tag)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (!file_->submit(data, len, tag))
+    {
+        write_errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (shouldRoll())
     {
         rollFile();
+        rolls_.fetch_add(1, std::memory_order_relaxed);
     }
 }
 
+void LogFile::takeCompleted(std::vector<void *> &tags, bool wait)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    tags.insert(tags.end(), completed_.begin(), completed_.end());
+    completed_.clear();
+    int failed = file_->takeCompleted(tags, wait);
+    write_errors_.fetch_add(failed, std::memory_order_relaxed);
+
+    // 后台线程关闭的旧文件
+    std::unique_lock<std::mutex> helper_guard(helper_mutex_);
+    if (wait)
+    {
+        idle_cond_.wait(helper_guard, [this] { return retired_.empty() && retiring_ == 0; });
+    }
+    tags.insert(tags.end(), retired_completed_.begin(), retired_completed_.end());
+    retired_completed_.clear();
+}
+
 void LogFile::flush()
 {
     std::unique_lock<std::mutex> guard(mutex_);
-    file_->flush();
+    if (!file_->flush())
+    {
+        write_errors_.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
 
 // 滚动日志：相当于重新生成日志文件，再向里面写数据 
 void LogFile::rollFile()
 {
-    // 生成一个日志文件名
-    std::string file_name = getLogFileNmae();
-    // 指向新的文件
-    file_.reset(new FileWritter(file_name.c_str()));
+    time_t now = ::time(nullptr);
+    // 按时间滚动时对齐到日志时间所在时区的周期边界，例如按天滚动时在当地的零点滚动
+    if (options_.roll_period > 0)
+    {
+        time_t offset = g_time_zone_offset.load(std::memory_order_relaxed);
+        next_roll_time_ = ((now + offset) / options_.roll_period + 1) * options_.roll_period - offset;
+    }
+    std::unique_ptr<LogWriter> old_file = std::move(file_);
+    std::string old_name = std::move(file_name_);
+    if (options_.preopen)
+    {
+        std::unique_lock<std::mutex> guard(helper_mutex_);
+        if (next_file_)
+        {
+            // 后台线程已经准备好：只需要交换指针，文件名改为启用时的时间
+            file_ = std::move(next_file_);
+            file_name_ = getLogFileNmae(now, next_index_);
+            if (file_name_ != next_name_ && !renameFile(next_name_, file_name_))
+            {
+                file_name_ = next_name_;
+            }
+        }
+        else
+        {
+            // 后台线程还没有准备好(第一次打开或者滚动太快)，只能在这里打开
+            file_name_ = getLogFileNmae(now, file_index_++);
+            guard.unlock();
+            file_ = makeWriter(file_name_);
+            guard.lock();
+        }
+        // 旧文件的关闭和符号链接的更新交给后台线程
+        if (old_file)
+        {
+            retired_.push_back(RetiredFile{std::move(old_file), old_name});
+        }
+        link_target_ = file_name_;
+        guard.unlock();
+        helper_cond_.notify_one();
+        return;
+    }
+
+    // 旧文件中还在写的缓冲区必须等它写完，再交给调用者回收
+    if (old_file)
+    {
+        int failed = old_file->takeCompleted(completed_, true);
+        write_errors_.fetch_add(failed, std::memory_order_relaxed);
+        old_file.reset();
+        if (archiver_)
+        {
+            archiver_->closed(old_name);
+        }
+    }
+    // 生成一个日志文件名，指向新的文件
+    file_name_ = getLogFileNmae(now, file_index_++);
+    file_ = makeWriter(file_name_);
+    updateLink(file_name_);
+}
+
+void LogFile::updateLink(const std::string &file_name)
+{
     unlink(linkname_);
     symlink(file_name.c_str(), linkname_);
 }
 
-void LogFile::setBaseName()
+void LogFile::retire(std::unique_ptr<LogWriter> file, const std::string &file_name, std::vector<void *> &tags)
+{
+    int failed = file->takeCompleted(tags, true);
+    if (!file->sync())
+    {
+        ++failed;
+    }
+    write_errors_.fetch_add(failed, std::memory_order_relaxed);
+    // 析构时关闭文件
+    file.reset();
+    if (archiver_)
+    {
+        archiver_->closed(file_name);
+    }
+}
+
+void LogFile::helperThread()
+{
+    ::pthread_setname_np(::pthread_self(), "LogFileHelper");
+
+    std::unique_lock<std::mutex> guard(helper_mutex_);
+    for (;;)
+    {
+        helper_cond_.wait(guard, [this] {
+            return !helper_running_ || !retired_.empty() || !link_target_.empty() || !next_file_;
+        });
+
+        // 先关闭旧文件，再准备下一个文件
+        std::vector<RetiredFile> retired;
+        retired.swap(retired_);
+        std::string link_target;
+        link_target.swap(link_target_);
+        retiring_ += static_cast<int>(retired.size());
+        guard.unlock();
+
+        std::vector<void *> tags;
+        for (auto &retired_file : retired)
+        {
+            retire(std::move(retired_file.file), retired_file.name, tags);
+        }
+        if (!link_target.empty())
+        {
+            updateLink(link_target);
+        }
+
+        guard.lock();
+        retired_completed_.insert(retired_completed_.end(), tags.begin(), tags.end());
+        retiring_ -= static_cast<int>(retired.size());
+        if (retired_.empty() && retiring_ == 0)
+        {
+            idle_cond_.notify_all();
+        }
+        if (!helper_running_)
+        {
+            if (retired_.empty() && link_target_.empty())
+            {
+                break;
+            }
+            continue;
+        }
+        if (!next_file_)
+        {
+            int index = file_index_++;
+            std::string file_name = getLogFileNmae(::time(nullptr), index);
+            guard.unlock();
+            std::unique_ptr<LogWriter> file = makeWriter(file_name);
+            guard.lock();
+            next_file_ = std::move(file);
+            next_name_ = file_name;
+            next_index_ = index;
+        }
+    }
+}
+
+bool LogFile::basePath(const LogFileOptions &options, std::string *dir, std::string *prefix)
 {
     char log_abs_path[PATH_MAX] = {0};
     ::getcwd(log_abs_path, sizeof(log_abs_path));
@@ -81,29 +358,64 @@ void LogFile::setBaseName()
     }
 
     char process_abs_path[PATH_MAX] = {0};
-    long len = ::readlink("/proc/sel/exe", process_abs_path, sizeof(process_abs_path));
+    long len = ::readlink("/proc/self/exe", process_abs_path, sizeof(process_abs_path));
     if (len <= 0)
     {
-        return;
+        return false;
     }
     char *process_name = strrchr(process_abs_path, '/') + 1;
-    snprintf(linkname_, sizeof(linkname_), "%s%s.log", log_abs_path, process_name);
-    snprintf(basename_, sizeof(basename_), "%s%s.%d", log_abs_path, process_name, ::getpid());
+    *dir = log_abs_path;
+    *prefix = process_name;
+    if (!options.name.empty())
+    {
+        *prefix += "." + options.name;
+    }
+    return true;
+}
+
+void LogFile::setBaseName()
+{
+    if (!basePath(options_, &log_dir_, &process_name_))
+    {
+        return;
+    }
+    snprintf(linkname_, sizeof(linkname_), "%s%s.log", log_dir_.c_str(), process_name_.c_str());
+    snprintf(basename_, sizeof(basename_), "%s%s.%d", log_dir_.c_str(), process_name_.c_str(), ::getpid());
 }
 
-std::string LogFile::getLogFileNmae()
+bool LogFile::renameFile(const std::string &from, const std::string &to)
+{
+    // 已经打开的文件描述符不受影响
+    if (::rename(from.c_str(), to.c_str()) != 0)
+    {
+        return false;
+    }
+    if (options_.inline_compress)
+    {
+        ::rename((from + ".idx").c_str(), (to + ".idx").c_str());
+    }
+    if (archiver_)
+    {
+        archiver_->renamed(from, to);
+    }
+    return true;
+}
+
+std::string LogFile::getLogFileNmae(time_t now, int index)
 {
     std::string file_name(basename_);
     char timebuf[32] = {0};
     struct tm tm;
-    time_t now = time(nullptr);
     ::gmtime_r(&now, &tm);
     strftime(timebuf, sizeof(timebuf), "%Y%m%d-%H%M%S.", &tm);
     file_name += timebuf;
 
-    char index[8] = {0};
-    snprintf(index, sizeof(index), "%3d.log", file_index_);
-    ++file_index_;
-    file_name += index;
+    char index_buf[32] = {0}; // 足够放下 int 的全部取值
+    snprintf(index_buf, sizeof(index_buf), "%3d.log", index);
+    file_name += index_buf;
+    if (options_.inline_compress)
+    {
+        file_name += ".gz";
+    }
     return file_name;
 }
@@ -2,58 +2,199 @@
 
 #include "noncopyable.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
 #include <stdio.h>
 #include <limits.h>
+#include <unistd.h>
+
+// 日志文件的写入方式
+enum class FileBackend
+{
+    kStdio, // stdio 缓冲写入
+    kUring, // io_uring 异步写入大缓冲区，不可用时退回 pwritev
+    kMmap,  // 预先分配文件空间，通过滑动的 mmap 窗口写入
+};
+
+// 日志文件的选项
+struct LogFileOptions
+{
+    FileBackend backend = FileBackend::kStdio; // 写入方式
+    bool preopen = false;                      // 由后台线程预先打开下一个文件，并在后台关闭旧文件
+    std::string name;                          // 附加在程序名之后，区分同一进程中的多个日志文件(例如分片)
+
+    int roll_period = 0;               // 按时间滚动的周期(秒)，例如 3600、86400，按日志时间所用的时区对齐，0 表示只按大小滚动
+    int max_files = 0;                 // 最多保留的日志文件数(包括压缩后的、正在写的和预先打开的)，0 表示不限制
+    off_t max_total_bytes = 0;         // 所有日志文件的总大小上限，0 表示不限制
+    bool compress = false;             // 用 gzip 压缩滚动后的文件(需要 zlib)
+    int compress_cpu_percent = 25;     // 压缩线程最多占用的 CPU 比例
+    size_t compress_bytes_per_sec = 0; // 压缩线程每秒最多读取的字节数，0 表示不限制
+
+    bool inline_compress = false;  // 写入时压缩：每次 flush 压缩为一个独立的 gzip 帧，文件名为 .log.gz，索引为 .log.gz.idx(需要 zlib，没有时忽略)
+    int inline_compress_level = 1; // 写入时压缩的 zlib 压缩级别
+
+    bool crash_safe = false; // 异步日志的缓冲区放在 log/<程序名>.buf 文件的共享映射中，进程崩溃后可以恢复
+};
+
+/**
+ * 日志文件的写入接口
+ * append() 同步写入，返回时数据已经被复制走；
+ * submit() 异步写入，数据在写完之前必须保持有效，写完后 tag 由 takeCompleted() 返回
+ */
+class LogWriter : noncopyable
+{
+public:
+    LogWriter() : written_bytes_(0) {}
+    virtual ~LogWriter() = default;
+
+    // 返回已经写入日志的字节数
+    off_t writtenBytes() const { return written_bytes_; }
+    // 写数据，写入失败时返回 false
+    virtual bool append(const char *line, const size_t len) = 0;
+    // 刷新缓冲区数据到文件，失败时返回 false
+    virtual bool flush() = 0;
+    // 刷新并等待数据写入磁盘(fsync)，关闭旧文件之前调用
+    virtual bool sync() = 0;
+
+    // 默认实现：同步写入，立即完成
+    virtual bool submit(const char *data, size_t len, void *tag)
+    {
+        bool ok = append(data, len);
+        completed_.push_back(tag);
+        return ok;
+    }
+    // 取出已经写完的 tag，wait 为 true 时等待所有写入完成。返回其中写入失败的个数
+    virtual int takeCompleted(std::vector<void *> &tags, bool wait)
+    {
+        (void)wait;
+        tags.insert(tags.end(), completed_.begin(), completed_.end());
+        completed_.clear();
+        return 0;
+    }
+
+protected:
+    // 对正在写的文件加共享的 flock，其他进程清理日志目录时据此跳过这个文件，关闭文件时自动释放
+    static void lockInUse(int fd);
+
+    off_t written_bytes_; // 已经写入日志的字节数
+
+private:
+    std::vector<void *> completed_;
+};
 
 // 用于写日志数据到本地文件
-class FileWritter : noncopyable
+class FileWritter : public LogWriter
 {
 public:
     explicit FileWritter(std::string file_name)
-        : file_(::fopen(file_name.c_str(), "ae")), // 'e' for O_CLOEXEC
-          written_bytes_(0)
+        : file_(::fopen(file_name.c_str(), "ae")) // 'e' for O_CLOEXEC
     {
         // <stdio.h> 设置文件流的缓冲区
         ::setbuffer(file_, buffer_, sizeof(buffer_));
+        lockInUse(::fileno(file_));
     }
 
     ~FileWritter() { ::fclose(file_); } // 关闭文件，会强制flush缓冲区
 
-    // 返回已经写入日志的字节数
-    off_t writtenBytes() const { return written_bytes_; }
-    // 写数据到缓冲区
-    void append(const char *line, const size_t len);
-    // 刷新缓冲区数据到文件
-    void flush() { ::fflush(file_); }
+    bool append(const char *line, const size_t len) override;
+    bool flush() override { return ::fflush(file_) == 0; }
+    bool sync() override { return ::fflush(file_) == 0 && ::fsync(::fileno(file_)) == 0; }
 
 private:
     FILE *file_;             // 文件指针
     char buffer_[64 * 1024]; // 文件输出缓冲区, 64kB
-    off_t written_bytes_;    // 已经写入日志的字节数
 };
 
-// annotation
+/**
+ * 日志文件：写满 roll_size 后滚动到新文件
+ * 开启 preopen 时，后台线程预先创建好下一个文件(mmap 方式同时完成预先分配和映射)，
+ * 滚动时只需要交换指针(并把文件改名为启用时的时间)；旧文件的 flush、fsync、关闭和符号链接的更新也在后台线程中完成
+ */
+class LogArchiver;
+
 class LogFile : noncopyable
 {
 public:
-    LogFile(off_t roll_size);
+    LogFile(off_t roll_size, const LogFileOptions &options = LogFileOptions());
     ~LogFile();
 
     void append(const char *line, const size_t len);
     void flush();
+
+    /**
+     * 异步写入一个大缓冲区：data 在写完之前必须保持有效
+     * 写完后 tag 由 takeCompleted() 返回，调用者此时才能回收缓冲区
+     */
+    void submit(const char *data, size_t len, void *tag);
+    // 取出已经写完的 tag，wait 为 true 时等待所有写入完成
+    void takeCompleted(std::vector<void *> &tags, bool wait);
     // 滚动日志
     void rollFile();
 
+    // 滚动次数(不包括第一次打开文件)
+    uint64_t rollCount() const { return rolls_.load(std::memory_order_relaxed); }
+    // 写入失败次数
+    uint64_t writeErrors() const { return write_errors_.load(std::memory_order_relaxed); }
+
+    // 日志目录(不存在时创建)和日志文件名的前缀：<当前目录>/log/ 和 <程序名>[.name]
+    static bool basePath(const LogFileOptions &options, std::string *dir, std::string *prefix);
+
 private:
+    // 等待关闭的旧文件
+    struct RetiredFile
+    {
+        std::unique_ptr<LogWriter> file;
+        std::string name;
+    };
+
     void setBaseName();
-    std::string getLogFileNmae();
+    // 按写入方式创建写入器
+    std::unique_ptr<LogWriter> makeWriter(const std::string &file_name);
+    // 文件名中的时间为 now，序号为 index
+    std::string getLogFileNmae(time_t now, int index);
+    // 预先打开的文件改名为启用时的文件名，失败时返回 false
+    bool renameFile(const std::string &from, const std::string &to);
+    // 更新指向当前文件的符号链接
+    void updateLink(const std::string &file_name);
+    // 当前文件是否需要滚动：超过大小或者到达时间周期的边界
+    bool shouldRoll() const;
+    // 关闭旧文件：等待写入完成并 fsync，然后交给 archiver_ 压缩和清理
+    void retire(std::unique_ptr<LogWriter> file, const std::string &file_name, std::vector<void *> &tags);
+    // 后台线程：预先打开下一个文件，关闭旧文件
+    void helperThread();
 
     char linkname_[PATH_MAX];
     char basename_[PATH_MAX];
+    std::string log_dir_;      // 日志目录
+    std::string process_name_; // 程序名，也是日志文件名的前缀
     off_t roll_size_;
     int file_index_;
     std::mutex mutex_;
-    std::unique_ptr<FileWritter> file_;
+    const LogFileOptions options_;
+    std::unique_ptr<LogWriter> file_;
+    std::string file_name_;              // 当前文件的文件名
+    time_t next_roll_time_;              // 按时间滚动时，下一次滚动的时间
+    std::vector<void *> completed_;      // 滚动前的文件中已经写完的 tag
+    std::atomic<uint64_t> rolls_;        // 滚动次数
+    std::atomic<uint64_t> write_errors_; // 写入失败次数
+    std::unique_ptr<LogArchiver> archiver_; // 压缩和清理旧文件，不需要时为空
+
+    // 后台线程使用，由 helper_mutex_ 保护(file_index_ 在开启 preopen 后也由它保护)
+    std::mutex helper_mutex_;
+    std::condition_variable helper_cond_;             // 通知后台线程有新的任务
+    std::condition_variable idle_cond_;               // 通知旧文件已经全部关闭
+    std::unique_ptr<LogWriter> next_file_;            // 预先打开的下一个文件
+    std::string next_name_;                           // 下一个文件的文件名(准备时的时间)
+    int next_index_;                                  // 下一个文件的序号
+    std::vector<RetiredFile> retired_;                // 等待关闭的旧文件
+    std::string link_target_;                         // 符号链接需要指向的文件，空表示不需要更新
+    std::vector<void *> retired_completed_;           // 旧文件中已经写完的 tag
+    int retiring_;                                    // 后台线程正在关闭的旧文件数
+    bool helper_running_;                             // 后台线程是否继续运行
+    std::thread helper_;                              // 后台线程，最后初始化
 };
\ No newline at end of file
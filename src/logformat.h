@@ -0,0 +1,253 @@
+#pragma once
+
+#include "logstream.h"
+
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <stdint.h>
+
+/**
+ * 编译期解析的格式串：{} 表示参数，{{ 和 }} 表示花括号本身
+ * 格式串在编译期被拆成 参数个数+1 段文字(已经去掉转义)，输出时依次复制文字、调用参数类型对应的格式化函数
+ * 先按各段文字和参数的最大长度预留一次空间，放得下时直接写入，不再逐项检查剩余空间
+ * 参数个数不匹配、花括号不成对或者参数类型不支持时编译报错
+ *
+ * 用法：
+ *     LOG_INFOF("order {} filled at {}", id, price);
+ */
+
+// 返回格式串中的参数个数，花括号不成对时返回 -1
+constexpr int countFormatArgs(const char *format)
+{
+    int count = 0;
+    for (const char *f = format; *f != '\0'; ++f)
+    {
+        if (f[0] == '{' && f[1] == '{')
+        {
+            ++f;
+        }
+        else if (f[0] == '}' && f[1] == '}')
+        {
+            ++f;
+        }
+        else if (f[0] == '{' && f[1] == '}')
+        {
+            ++count;
+            ++f;
+        }
+        else if (f[0] == '{' || f[0] == '}')
+        {
+            return -1;
+        }
+    }
+    return count;
+}
+
+/**
+ * 解析后的格式串
+ * SIZE 为格式串的长度(含末尾的 \0)，ARGS 为参数个数
+ * 第 i 段文字为 text_[offsets_[i], offsets_[i + 1])
+ */
+template <int SIZE, int ARGS>
+struct FormatPattern
+{
+    constexpr explicit FormatPattern(const char *format) : text_(), offsets_()
+    {
+        int len = 0;
+        int index = 0;
+        for (const char *f = format; *f != '\0'; ++f)
+        {
+            if ((f[0] == '{' || f[0] == '}') && f[1] == f[0])
+            {
+                // 转义的花括号
+                text_[len++] = *f++;
+            }
+            else if (f[0] == '{' && f[1] == '}')
+            {
+                offsets_[++index] = len;
+                ++f;
+            }
+            else
+            {
+                text_[len++] = *f;
+            }
+        }
+        offsets_[ARGS + 1] = len;
+    }
+
+    // 第 i 段文字
+    const char *segment(int i) const { return text_ + offsets_[i]; }
+    int segmentLength(int i) const { return offsets_[i + 1] - offsets_[i]; }
+    // 所有文字的总长度
+    int textLength() const { return offsets_[ARGS + 1]; }
+
+    char text_[SIZE];
+    int offsets_[ARGS + 2];
+};
+
+/**
+ * 参数类型萃取：格式化后的最大长度和直接写入的方法，写入时调用者已经预留了 maxSize() 字节
+ * 数值类型使用 LogStream 的格式化函数；不支持的类型在编译时报错
+ */
+template <class T, class Enable = void>
+struct FormatArg;
+
+template <>
+struct FormatArg<bool>
+{
+    static int maxSize(bool) { return 1; }
+    static char *write(char *p, bool v)
+    {
+        *p = v ? '1' : '0';
+        return p + 1;
+    }
+};
+
+template <>
+struct FormatArg<char>
+{
+    static int maxSize(char) { return 1; }
+    static char *write(char *p, char v)
+    {
+        *p = v;
+        return p + 1;
+    }
+};
+
+template <class T>
+struct FormatArg<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                                            !std::is_same<T, char>::value>::type>
+{
+    static int maxSize(T) { return kMaxNumericSize; }
+    static char *write(char *p, T v)
+    {
+        if (std::is_signed<T>::value)
+        {
+            return p + convertSigned(p, static_cast<int64_t>(v));
+        }
+        return p + convertDecimal(p, static_cast<uint64_t>(v));
+    }
+};
+
+template <class T>
+struct FormatArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static int maxSize(T) { return kMaxNumericSize; }
+    static char *write(char *p, T v)
+    {
+        // long double 按 double 输出
+        using Stored = typename std::conditional<std::is_same<T, float>::value, float, double>::type;
+        return p + convertFloating(p, static_cast<Stored>(v));
+    }
+};
+
+// 字符串：输出前需要求出长度，空指针输出 (null)
+struct FormatStringArg
+{
+    static int maxSize(const char *v) { return v ? static_cast<int>(strlen(v)) : 6; }
+    static char *write(char *p, const char *v)
+    {
+        int len = maxSize(v);
+        memcpy(p, v ? v : "(null)", len);
+        return p + len;
+    }
+};
+
+template <>
+struct FormatArg<const char *> : FormatStringArg
+{
+};
+
+template <>
+struct FormatArg<char *> : FormatStringArg
+{
+};
+
+template <>
+struct FormatArg<std::string>
+{
+    static int maxSize(const std::string &v) { return static_cast<int>(v.size()); }
+    static char *write(char *p, const std::string &v)
+    {
+        memcpy(p, v.data(), v.size());
+        return p + v.size();
+    }
+};
+
+// 其他指针按地址输出
+template <class T>
+struct FormatArg<T *, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+    static int maxSize(const T *) { return kMaxNumericSize; }
+    static char *write(char *p, const T *v) { return p + convertPointer(p, v); }
+};
+
+// 数组按指针处理：字符数组为字符串
+template <class T>
+using FormatArgOf = FormatArg<typename std::decay<T>::type>;
+
+// 空间不足时逐项写入一个参数：字符串直接追加，其他类型按 FormatArg 写到栈上再追加(与预留空间时的输出相同)
+template <class T>
+void appendFormatArg(LogStream &stream, const T &v)
+{
+    using Arg = FormatArgOf<T>;
+    if constexpr (std::is_base_of<FormatStringArg, Arg>::value ||
+                  std::is_same<typename std::decay<T>::type, std::string>::value)
+    {
+        stream << v;
+    }
+    else
+    {
+        char buf[kMaxNumericSize];
+        stream.append(buf, static_cast<int>(Arg::write(buf, v) - buf));
+    }
+}
+
+// 按解析后的格式串把参数写入 stream
+template <int SIZE, int ARGS, class... Args, size_t... I>
+void formatPattern(LogStream &stream, const FormatPattern<SIZE, ARGS> &pattern, std::index_sequence<I...>,
+                   const Args &...args)
+{
+    int bound = pattern.textLength();
+    int sizes[] = {0, (bound += FormatArgOf<Args>::maxSize(args), 0)...};
+    (void)sizes;
+
+    if (char *begin = stream.reserve(bound))
+    {
+        // 常见情况：空间足够，一次检查之后直接写入
+        char *p = begin;
+        int expand[] = {0, (memcpy(p, pattern.segment(I), pattern.segmentLength(I)),
+                            p = FormatArgOf<Args>::write(p + pattern.segmentLength(I), args), 0)...};
+        (void)expand;
+        memcpy(p, pattern.segment(ARGS), pattern.segmentLength(ARGS));
+        p += pattern.segmentLength(ARGS);
+        stream.commit(p - begin);
+    }
+    else
+    {
+        // 空间不足：逐项写入，放不下的部分被截断
+        int expand[] = {0, (stream.append(pattern.segment(I), pattern.segmentLength(I)), appendFormatArg(stream, args), 0)...};
+        (void)expand;
+        stream.append(pattern.segment(ARGS), pattern.segmentLength(ARGS));
+    }
+}
+
+template <int SIZE, int ARGS, class... Args>
+void formatPattern(LogStream &stream, const FormatPattern<SIZE, ARGS> &pattern, const Args &...args)
+{
+    formatPattern(stream, pattern, std::index_sequence_for<Args...>(), args...);
+}
+
+/**
+ * 把 fmt 和参数写入 stream，fmt 必须是字符串字面量
+ * 每个调用点展开为一个独立的 lambda，其中的静态常量就是编译期解析后的格式串
+ */
+#define LOG_FORMAT_TO(stream, fmt, ...)                                                                 \
+    [](LogStream &ddlog_stream, const auto &...ddlog_args) {                                            \
+        static_assert(countFormatArgs(fmt) >= 0, "unbalanced '{' or '}' in log format string");         \
+        static_assert(countFormatArgs(fmt) == static_cast<int>(sizeof...(ddlog_args)),                  \
+                      "number of {} in log format string does not match the number of arguments");      \
+        static constexpr FormatPattern<sizeof(fmt), countFormatArgs(fmt)> ddlog_pattern(fmt);           \
+        formatPattern(ddlog_stream, ddlog_pattern, ddlog_args...);                                      \
+    }(stream, ##__VA_ARGS__)
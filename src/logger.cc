@@ -1,32 +1,170 @@
 #include "logger.h"
 #include "timestamp.h"
+#include "currentthread.h"
+#include "flightrecorder.h"
 
-#include <sys/syscall.h>
-#include <sys/types.h>
-#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
+#include <unistd.h>
 
 // 保存日志级别的名字
 const char *LogLevelName[Logger::NUM_LOG_LEVELS] = {
     "TRACE ",
     "DEBUG ",
-    "INFO ",
-    "WARN ",
+    "INFO  ",
+    "WARN  ",
     "ERROR ",
     "FATAL ",
 };
 
+static_assert(Logger::NUM_LOG_LEVELS == kNumLogLevels, "AsyncLogging must track every log level");
+
+// 全局变量：当前日志级别, 默认为 INFO
+std::atomic<Logger::LogLevel> g_log_level(Logger::INFO);
+// 全局变量：写入飞行记录器的最低级别，默认关闭
+std::atomic<int> g_record_level(Logger::NUM_LOG_LEVELS);
+// 全局变量：需要构造 Logger 的最低级别
+std::atomic<Logger::LogLevel> g_lowest_level(Logger::INFO);
+
+namespace
+{
+// 模块级别的注册表：slot 创建后不会释放，调用点可以一直持有它的引用
+struct LevelRegistry
+{
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<LogLevelSlot>> slots;
+};
+
+// 函数内的静态变量：其他编译单元的静态初始化中也可以输出日志
+LevelRegistry &levelRegistry()
+{
+    static LevelRegistry registry;
+    return registry;
+}
+
+// 更新 slot 的级别，调用者持有注册表的锁
+void storeSlotLevel(LogLevelSlot &slot, int level)
+{
+    slot.level.store(level, std::memory_order_relaxed);
+    slot.lowest.store(std::min(level, g_record_level.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+}
+
+// 当前日志级别或者飞行记录器级别改变后，更新所有跟随当前日志级别的模块
+void refreshLevels()
+{
+    LevelRegistry &registry = levelRegistry();
+    std::unique_lock<std::mutex> guard(registry.mutex);
+    Logger::LogLevel level = g_log_level.load(std::memory_order_relaxed);
+    int lowest = std::min(static_cast<int>(level), g_record_level.load(std::memory_order_relaxed));
+    g_lowest_level.store(static_cast<Logger::LogLevel>(lowest), std::memory_order_relaxed);
+    for (auto &entry : registry.slots)
+    {
+        LogLevelSlot &slot = *entry.second;
+        storeSlotLevel(slot, slot.overridden ? slot.level.load(std::memory_order_relaxed) : level);
+    }
+}
+} // namespace
+
 // 设置当前日志级别
 void Logger::setLogLevel(LogLevel level)
 {
-    g_log_level = level;
+    g_log_level.store(level, std::memory_order_relaxed);
+    refreshLevels();
 }
 
-// 全局变量：当前日志级别, 默认为 INFO
-Logger::LogLevel g_log_level = Logger::INFO;
+LogLevelSlot &Logger::levelSlot(const char *module)
+{
+    LevelRegistry &registry = levelRegistry();
+    std::unique_lock<std::mutex> guard(registry.mutex);
+    std::unique_ptr<LogLevelSlot> &slot = registry.slots[module];
+    if (!slot)
+    {
+        slot.reset(new LogLevelSlot);
+        slot->overridden = false;
+        storeSlotLevel(*slot, g_log_level.load(std::memory_order_relaxed));
+    }
+    return *slot;
+}
+
+void Logger::setModuleLevel(const char *module, LogLevel level)
+{
+    LogLevelSlot &slot = levelSlot(module);
+    std::unique_lock<std::mutex> guard(levelRegistry().mutex);
+    slot.overridden = true;
+    storeSlotLevel(slot, level);
+}
+
+void Logger::resetModuleLevel(const char *module)
+{
+    LogLevelSlot &slot = levelSlot(module);
+    std::unique_lock<std::mutex> guard(levelRegistry().mutex);
+    slot.overridden = false;
+    storeSlotLevel(slot, g_log_level.load(std::memory_order_relaxed));
+}
 
-// 全局变量：是否使用异步日志，默认为false
-bool g_is_async_ = false;
+// 全局变量：时区偏移(秒)，默认为东八区
+std::atomic<int> g_time_zone_offset(8 * 3600);
+
+// 设置时区
+void Logger::setTimeZone(int offset_seconds)
+{
+    g_time_zone_offset.store(offset_seconds, std::memory_order_relaxed);
+}
+
+// 全局变量：日志记录的格式，默认为文本
+std::atomic<LogStream::RecordFormat> g_record_format(LogStream::kText);
+
+void Logger::setRecordFormat(LogStream::RecordFormat format)
+{
+    g_record_format.store(format, std::memory_order_relaxed);
+}
+
+// 全局变量：一条日志的最大长度，以及截断的统计
+std::atomic<int> g_max_message_size(1024 * 1024);
+std::atomic<uint64_t> g_truncated_messages(0);
+std::atomic<uint64_t> g_truncated_bytes(0);
+
+void Logger::setMaxMessageSize(int bytes)
+{
+    g_max_message_size.store(bytes, std::memory_order_relaxed);
+}
+
+uint64_t Logger::truncatedMessages()
+{
+    return g_truncated_messages.load(std::memory_order_relaxed);
+}
+
+uint64_t Logger::truncatedBytes()
+{
+    return g_truncated_bytes.load(std::memory_order_relaxed);
+}
+
+// 截断过的日志计入统计
+static void countTruncated(const LogStream::Buffer &buf)
+{
+    if (int truncated = buf.truncated())
+    {
+        g_truncated_messages.fetch_add(1, std::memory_order_relaxed);
+        g_truncated_bytes.fetch_add(static_cast<uint64_t>(truncated), std::memory_order_relaxed);
+    }
+}
+
+// 设置当前线程名
+void Logger::setThreadName(const char *name)
+{
+    CurrentThread::setName(name);
+}
+
+// 全局变量：异步日志后端，默认为空(同步日志)
+AsyncLogging *g_async_logging = nullptr;
+ShardedAsyncLogging *g_sharded_logging = nullptr;
 
 // 该类方便存储字符串长度信息
 class T
@@ -65,74 +203,404 @@ Logger::OutputFunc g_output_func = defaultOutput;
 void Logger::setOutputFunc(OutputFunc func)
 {
     g_output_func = func;
+    // 自定义的输出方法需要经过复制的路径
+    g_async_logging = nullptr;
+    g_sharded_logging = nullptr;
+}
+
+namespace
+{
+// 输出飞行记录器中的一条日志
+void outputRecorded(const char *data, int len, int level)
+{
+    if (AsyncLogging *async = Logger::asyncLogging())
+    {
+        async->append(data, len, level);
+    }
+    else
+    {
+        StreamBuffer buf(const_cast<char *>(data), len);
+        buf.add(static_cast<size_t>(len));
+        g_output_func(buf);
+    }
+}
+
+const int kCrashSignals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+// 安装崩溃处理之前的信号处理方式
+struct sigaction g_previous_actions[NSIG];
+bool g_crash_handler_installed = false;
+
+// 异步日志时崩溃输出的文件：log/<程序名>.<pid>.crash.log，安装崩溃处理时提前生成
+char g_crash_path[PATH_MAX] = {0};
+
+void setCrashPath()
+{
+    char exe[PATH_MAX] = {0};
+    char cwd[PATH_MAX] = {0};
+    if (::readlink("/proc/self/exe", exe, sizeof(exe) - 1) <= 0 || !::getcwd(cwd, sizeof(cwd)))
+    {
+        return;
+    }
+    const char *name = strrchr(exe, '/');
+    snprintf(g_crash_path, sizeof(g_crash_path), "%s/log/%s.%d.crash.log", cwd, name ? name + 1 : exe, ::getpid());
+}
+
+/**
+ * 崩溃时输出所有线程的飞行记录器，然后交给之前的处理方式
+ * 只使用异步信号安全的函数：不经过异步日志(会加锁、分配内存)，也不等待日志线程，
+ * 异步日志时 write(2) 到提前生成的文件中(与 crash_safe 的缓冲区文件相同)，同步日志时写到标准输出
+ */
+void crashHandler(int sig)
+{
+    int fd = STDOUT_FILENO;
+    if ((g_async_logging || g_sharded_logging) && g_crash_path[0] != '\0')
+    {
+        fd = ::open(g_crash_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    if (fd >= 0)
+    {
+        FlightRecorder::dumpAllForCrash(fd);
+        if (fd != STDOUT_FILENO)
+        {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+    ::sigaction(sig, &g_previous_actions[sig], nullptr);
+    ::raise(sig);
+}
+} // namespace
+
+void Logger::setFlightRecorder(LogLevel level, size_t bytes_per_thread, bool crash_handler)
+{
+    FlightRecorder::setCapacity(level < NUM_LOG_LEVELS ? bytes_per_thread : 0);
+    g_record_level.store(level, std::memory_order_relaxed);
+    refreshLevels();
+    if (crash_handler && level < NUM_LOG_LEVELS && !g_crash_handler_installed)
+    {
+        g_crash_handler_installed = true;
+        setCrashPath();
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = crashHandler;
+        sigemptyset(&action.sa_mask);
+        for (int sig : kCrashSignals)
+        {
+            ::sigaction(sig, &action, &g_previous_actions[sig]);
+        }
+    }
 }
 
 Logger::Logger(SourceFile file, int line)
-    : impl_(INFO, file, line)
+    : impl_(INFO, file, line, logLevel())
 {
+    impl_.beginMessage(nullptr, 0);
 }
 
 Logger::Logger(SourceFile file, int line, LogLevel level)
-    : impl_(level, file, line)
+    : impl_(level, file, line, logLevel())
 {
+    impl_.beginMessage(nullptr, 0);
 }
 Logger::Logger(SourceFile file, int line, LogLevel level, const char *func_name)
-    : impl_(level, file, line)
+    : impl_(level, file, line, logLevel())
+{
+    impl_.beginMessage(func_name, 0);
+}
+Logger::Logger(SourceFile file, int line, LogLevel level, const char *func_name, const LogLevelSlot &slot,
+               uint64_t suppressed)
+    : impl_(level, file, line, slot.logLevel())
 {
-    impl_.stream_ << func_name << ' ';
+    impl_.beginMessage(func_name, suppressed);
 }
 
 // Logger对象析构的时候将缓冲区中的内容输出
 Logger::~Logger()
 {
-    // 将换行符写入缓冲区中
-    stream() << "\n";
+    // 将换行符写入缓冲区中(结构化格式中先补全结构)
+    stream().endRecord();
 
     const LogStream::Buffer &buf(stream().buffer());
-    // 将缓冲区中的所有内容输出。默认输出到stdout
-    g_output_func(buf);
+    countTruncated(buf);
+    if (impl_.recorded_)
+    {
+        // 低于当前日志级别：只保存在飞行记录器中
+        if (FlightRecorder *recorder = FlightRecorder::local())
+        {
+            // 超过记录器单条上限时截断，同样计入统计
+            if (int truncated = recorder->record(buf.data(), buf.length(), impl_.level_))
+            {
+                g_truncated_messages.fetch_add(1, std::memory_order_relaxed);
+                g_truncated_bytes.fetch_add(static_cast<uint64_t>(truncated), std::memory_order_relaxed);
+            }
+        }
+        return;
+    }
+    if (impl_.async_ && !buf.overflowed())
+    {
+        // 日志内容已经在异步日志的暂存队列中，发布即可
+        impl_.async_->commit(buf.length(), impl_.time_, StagingRing::kText, impl_.level_);
+    }
+    else if (impl_.async_)
+    {
+        // 日志超出了暂存队列中预留的空间，已经换到更大的内存中：放弃预留，整条写入异步日志
+        impl_.async_->cancel();
+        impl_.async_->append(buf.data(), buf.length(), impl_.level_);
+    }
+    else if (AsyncLogging *async = Logger::asyncLogging())
+    {
+        // 暂存队列不可用，复制到异步日志的缓冲区中，同时传入级别供溢出策略使用
+        async->append(buf.data(), buf.length(), impl_.level_);
+    }
+    else
+    {
+        // 将缓冲区中的所有内容输出。默认输出到stdout
+        g_output_func(buf);
+    }
+}
+
+namespace
+{
+// 当前线程是否已经有 Logger 在使用暂存队列或者备用缓冲区
+thread_local bool t_storage_in_use = false;
+// 不能直接写入暂存队列时使用的备用缓冲区
+thread_local char t_fallback_buffer[kSmallBuffer];
+} // namespace
+
+bool Logger::Impl::isRecorded(LogLevel level, int threshold)
+{
+    // WARN 及以上的日志总是输出
+    return level < threshold && level < WARN;
+}
+
+char *Logger::Impl::acquireStorage(LogLevel level)
+{
+    if (level >= ERROR && g_record_level.load(std::memory_order_relaxed) < NUM_LOG_LEVELS)
+    {
+        // 先输出出错线程最近的低级别日志，作为这条错误的上下文。
+        // 必须在预留暂存队列之前：预留之后上下文只能进入溢出区，会被写在这条错误之后
+        if (FlightRecorder *recorder = FlightRecorder::local())
+        {
+            recorder->drain(outputRecorded);
+        }
+    }
+    if (t_storage_in_use)
+    {
+        // 极少发生：输出日志的过程中又输出了日志
+        owned_ = new char[kSmallBuffer];
+        return owned_;
+    }
+    t_storage_in_use = true;
+    // 写入飞行记录器的日志不占用暂存队列
+    if (recorded_)
+    {
+        return t_fallback_buffer;
+    }
+    if (AsyncLogging *async = Logger::asyncLogging())
+    {
+        char *reserved = async->reserve(kSmallBuffer);
+        if (reserved)
+        {
+            async_ = async;
+            return reserved;
+        }
+    }
+    return t_fallback_buffer;
+}
+
+Logger::Impl::~Impl()
+{
+    if (owned_)
+    {
+        delete[] owned_;
+    }
+    else
+    {
+        t_storage_in_use = false;
+    }
 }
 
 // Impl对象构造时就将日志的消息格式拼接后写入缓冲区中
-Logger::Impl::Impl(LogLevel level, const SourceFile &file, int line)
+Logger::Impl::Impl(LogLevel level, const SourceFile &file, int line, int threshold)
     : time_(Timestamp::now()),
-      stream_(),
+      format_(g_record_format.load(std::memory_order_relaxed)),
+      async_(nullptr),
+      owned_(nullptr),
+      recorded_(isRecorded(level, threshold)),
+      stream_(acquireStorage(level), kSmallBuffer),
       level_(level),
       file_(file),
       line_(line)
 {
+    stream_.setLimit(g_max_message_size.load(std::memory_order_relaxed));
+    if (format_ != LogStream::kText)
+    {
+        formatFields();
+        return;
+    }
     forMatTime();
     getThreadId();
     stream_ << T(LogLevelName[level], 6);
     stream_ << file_ << ':' << line_ << "->";
 }
 
+static void formatTime(LogStream &stream, int64_t time);
+
+// 结构化格式的日志头：JSON 为 {"time":"...","tid":1234,...，logfmt 为 time="..." tid=1234 ...
+static void formatFields(LogStream &stream, LogStream::RecordFormat format, int64_t time, int tid,
+                         const char *thread_name, Logger::LogLevel level, const Logger::SourceFile &file, int line)
+{
+    bool json = format == LogStream::kJson;
+    stream.setFormat(format);
+    stream << (json ? "{\"time\":\"" : "time=\"");
+    formatTime(stream, time);
+    stream << '"';
+    stream.kv("tid", tid);
+    if (thread_name[0] != '\0')
+    {
+        stream.kv("thread", thread_name);
+    }
+    // 级别名去掉末尾的空格
+    const char *name = LogLevelName[level];
+    int len = 6;
+    while (len > 0 && name[len - 1] == ' ')
+    {
+        --len;
+    }
+    stream << (json ? ",\"level\":\"" : " level=");
+    stream.append(name, len);
+    if (json)
+    {
+        stream << '"';
+    }
+    stream.kv("file", file.file_);
+    stream.kv("line", line);
+}
+
+// 日志头之后写入函数名和被限流跳过的次数，然后开始消息部分
+static void beginMessage(LogStream &stream, LogStream::RecordFormat format, const char *func_name,
+                         uint64_t suppressed)
+{
+    if (format == LogStream::kText)
+    {
+        if (func_name)
+        {
+            stream << func_name << ' ';
+        }
+        if (suppressed > 0)
+        {
+            stream << "(suppressed " << suppressed << ") ";
+        }
+        return;
+    }
+    if (func_name)
+    {
+        stream.kv("func", func_name);
+    }
+    if (suppressed > 0)
+    {
+        stream.kv("suppressed", static_cast<unsigned long long>(suppressed));
+    }
+    stream.beginMessage();
+}
+
+void Logger::Impl::formatFields()
+{
+    ::formatFields(stream_, format_, time_, CurrentThread::tid(), CurrentThread::name(), level_, file_, line_);
+}
+
+void Logger::Impl::beginMessage(const char *func_name, uint64_t suppressed)
+{
+    ::beginMessage(stream_, format_, func_name, suppressed);
+}
+
 // 格式化时间
-void Logger::Impl::forMatTime()
+static void formatTime(LogStream &stream, int64_t time)
 {
-    time_t seconds = static_cast<time_t>(time_ / Timestamp::kMicroSecondsPerSecond);       // 秒
-    time_t micro_seconds = static_cast<time_t>(time_ % Timestamp::kMicroSecondsPerSecond); // 毫秒
-
-    struct tm tm_time;
-    // 获取UTC格式时间，线程安全
-    ::gmtime_r(&seconds, &tm_time);
-
-    // 拼接时间
-    char t_time[64] = {0};
-    snprintf(t_time, sizeof(t_time), "%4d-%02d-%02d %02d:%02d:%02d",
-             tm_time.tm_year + 1900, tm_time.tm_mon + 1, tm_time.tm_mday,
-             tm_time.tm_hour + 8, tm_time.tm_min, tm_time.tm_sec);
-    // 拼接毫秒
-    char buf[32] = {0};
-    snprintf(buf, sizeof(buf), ".%03d", micro_seconds);
+    // 线程局部缓存："YYYY-MM-DD HH:MM:SS" 部分每秒最多变化一次
+    thread_local int64_t t_last_second = -1;
+    thread_local int t_last_offset = 0;
+    thread_local char t_time[32] = {0};
+
+    int64_t seconds = time / Timestamp::kMicroSecondsPerSecond;                           // 秒
+    int milli_seconds = static_cast<int>(time % Timestamp::kMicroSecondsPerSecond / 1000); // 毫秒
+    int offset = g_time_zone_offset.load(std::memory_order_relaxed);
+
+    if (seconds != t_last_second || offset != t_last_offset)
+    {
+        t_last_second = seconds;
+        t_last_offset = offset;
+        // 先加上时区偏移再转换，日期会随小时正确进位
+        time_t local_seconds = static_cast<time_t>(seconds + offset);
+        struct tm tm_time;
+        // 获取UTC格式时间，线程安全
+        ::gmtime_r(&local_seconds, &tm_time);
+        // 拼接时间 "YYYY-MM-DD HH:MM:SS"
+        convertPadded(t_time, static_cast<uint64_t>(tm_time.tm_year + 1900), 4);
+        t_time[4] = '-';
+        convertPadded(t_time + 5, static_cast<uint64_t>(tm_time.tm_mon + 1), 2);
+        t_time[7] = '-';
+        convertPadded(t_time + 8, static_cast<uint64_t>(tm_time.tm_mday), 2);
+        t_time[10] = ' ';
+        convertPadded(t_time + 11, static_cast<uint64_t>(tm_time.tm_hour), 2);
+        t_time[13] = ':';
+        convertPadded(t_time + 14, static_cast<uint64_t>(tm_time.tm_min), 2);
+        t_time[16] = ':';
+        convertPadded(t_time + 17, static_cast<uint64_t>(tm_time.tm_sec), 2);
+        t_time[19] = '.';
+    }
+
+    // 只改写毫秒部分
+    convertPadded(t_time + 20, static_cast<uint64_t>(milli_seconds), 3);
     // 输出
-    stream_ << T(t_time, 19) << T(buf, 4);
+    stream << T(t_time, 23);
+}
+
+// 格式化时间
+void Logger::Impl::forMatTime()
+{
+    formatTime(stream_, time_);
+}
+
+// 按照 Impl 的格式开始一条记录：供不经过 Logger 对象的日志使用
+void Logger::beginRecord(LogStream &stream, int64_t time, int tid, const char *thread_name, LogLevel level,
+                         const SourceFile &file, int line, const char *func_name)
+{
+    LogStream::RecordFormat format = g_record_format.load(std::memory_order_relaxed);
+    stream.setLimit(g_max_message_size.load(std::memory_order_relaxed));
+    if (format == LogStream::kText)
+    {
+        // 与 CurrentThread::tidString() 相同："%5d " 之后是线程名
+        char tid_buf[48];
+        char *p = tid_buf + convertPadded(tid_buf, static_cast<uint64_t>(tid), 5, ' ');
+        *p++ = ' ';
+        size_t name_len = strnlen(thread_name, 32);
+        if (name_len > 0)
+        {
+            memcpy(p, thread_name, name_len);
+            p += name_len;
+            *p++ = ' ';
+        }
+        formatTime(stream, time);
+        stream << T(tid_buf, static_cast<int>(p - tid_buf));
+        stream << T(LogLevelName[level], 6);
+        stream << file << ':' << line << "->";
+    }
+    else
+    {
+        ::formatFields(stream, format, time, tid, thread_name, level, file, line);
+    }
+    ::beginMessage(stream, format, func_name, 0);
+}
+
+void Logger::finishRecord(LogStream &stream)
+{
+    stream.endRecord();
+    countTruncated(stream.buffer());
 }
 
-// 获取当前线程id
+// 获取当前线程id：第一次调用后缓存在线程局部存储中
 void Logger::Impl::getThreadId()
 {
-    char buf[32] = {0};
-    int length = snprintf(buf, sizeof(buf), "%5lu", ::syscall(SYS_gettid));
-    stream_ << T(buf, length);
+    stream_ << T(CurrentThread::tidString(), CurrentThread::tidStringLength());
 }
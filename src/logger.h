@@ -1,9 +1,16 @@
 #pragma once
 #include <string.h>
 #include <functional>
+#include <atomic>
+#include <type_traits>
 
 #include "logstream.h"
+#include "logratelimit.h"
+#include "logformat.h"
 #include "asynclogging.h"
+#include "shardedlogging.h"
+
+struct LogLevelSlot;
 
 class Logger
 {
@@ -30,10 +37,27 @@ public:
             const char *slash = strrchr(file, '/');
             if (slash)
             {
-                file = slash + 1;
+                file_ = slash + 1;
             }
-            size_ = static_cast<int>(strlen(file));
+            size_ = static_cast<int>(strlen(file_));
         }
+        // 使用编译期求出的文件名：path 中文件名从 offset 开始，path 长度为 size
+        constexpr SourceFile(const char *path, int offset, int size) : file_(path + offset), size_(size - offset) {}
+
+        // 返回 path 中最后一个 / 之后的位置，供宏在编译期计算
+        static constexpr int basenameOffset(const char *path)
+        {
+            int offset = 0;
+            for (int i = 0; path[i] != '\0'; ++i)
+            {
+                if (path[i] == '/')
+                {
+                    offset = i + 1;
+                }
+            }
+            return offset;
+        }
+
         const char *file_; // 文件名
         int size_;         // 文件大小
     };
@@ -41,6 +65,12 @@ public:
     Logger(SourceFile file, int line);
     Logger(SourceFile file, int line, LogLevel level);
     Logger(SourceFile file, int line, LogLevel level, const char *func_name);
+    /**
+     * 宏使用：按调用点所属模块的级别 slot 判断是否只写入飞行记录器
+     * suppressed 为限流的调用点上次输出之后被跳过的次数，不为 0 时输出在消息之前
+     */
+    Logger(SourceFile file, int line, LogLevel level, const char *func_name, const LogLevelSlot &slot,
+           uint64_t suppressed = 0);
 
     ~Logger();
 
@@ -48,54 +78,171 @@ public:
     LogStream &stream() { return impl_.stream_; }
     // 返回当前日志级别
     static LogLevel logLevel();
-    // 设置当前日志级别
+    // 设置当前日志级别：没有单独设置级别的模块也随之改变
     static void setLogLevel(LogLevel level);
+    /**
+     * 返回模块的级别 slot，第一次使用时创建，之后地址不变
+     * 模块可以是标签(LOG_TAG 使用)，也可以是不带目录的源文件名(LOG_TRACE 等宏使用，例如 "tcpserver.cc")
+     */
+    static LogLevelSlot &levelSlot(const char *module);
+    // 返回源文件 file(__FILE__) 的级别 slot
+    static LogLevelSlot &fileLevelSlot(const char *file) { return levelSlot(SourceFile(file).file_); }
+    // 单独设置模块的日志级别，运行时可以随时修改
+    static void setModuleLevel(const char *module, LogLevel level);
+    // 取消单独设置的级别，重新跟随当前日志级别
+    static void resetModuleLevel(const char *module);
+    /**
+     * 开启飞行记录器：不低于 level 但低于当前日志级别的日志保存在线程自己的环形缓冲区中，不写入文件
+     * 当前线程输出 ERROR/FATAL 时，先输出它缓冲区中的日志；crash_handler 为 true 时，
+     * 收到 SIGSEGV/SIGBUS/SIGFPE/SIGILL/SIGABRT 时把所有线程的缓冲区写到标准输出(同步日志)
+     * 或者 log/<程序名>.<pid>.crash.log(异步日志)；异步日志中尚未写入的内容需要 crash_safe 才能保留
+     * level 为 NUM_LOG_LEVELS 时关闭
+     */
+    static void setFlightRecorder(LogLevel level, size_t bytes_per_thread = 64 * 1024, bool crash_handler = true);
+    // 返回需要构造 Logger 的最低级别：当前日志级别和飞行记录器级别中较低的一个
+    static LogLevel lowestLevel();
     // 设置为异步日志 
-    static void setAsync();
+    static void setAsync(AsyncLogging *async);
+    // 设置为分片的异步日志：每个线程写入自己对应的分片
+    static void setSharded(ShardedAsyncLogging *sharded);
+    // 返回当前线程使用的异步日志后端，同步日志时为空
+    static AsyncLogging *asyncLogging();
+    // 设置时区：相对UTC的偏移秒数，例如东八区为 8 * 3600
+    static void setTimeZone(int offset_seconds);
+    /**
+     * 设置日志记录的格式：kText(默认)、kJson(JSON Lines) 或 kLogfmt
+     * 结构化格式中时间、线程id、级别、文件名、行号和函数名都是字段，消息是 msg 字段，
+     * 之后是用 LogStream::kv() 添加的字段
+     */
+    static void setRecordFormat(LogStream::RecordFormat format);
+    /**
+     * 设置一条日志的最大长度(字节)，默认为 1MB，小于 kSmallBuffer 时按 kSmallBuffer 计算
+     * 超出栈上缓冲区的日志换到更大的内存中继续写入(优先使用线程缓存的内存块)，超过最大长度的部分被截断，
+     * 日志末尾注明截断的字节数(结构化格式中为 truncated 字段)
+     */
+    static void setMaxMessageSize(int bytes);
+    // 被截断的日志条数和截断的字节数(包括飞行记录器中超过单条上限被截断的日志)
+    static uint64_t truncatedMessages();
+    static uint64_t truncatedBytes();
+    // 设置当前线程名：输出在线程id之后
+    static void setThreadName(const char *name);
 
     // 输出方法回调
     using OutputFunc = std::function<void(const LogStream::Buffer &)>;
-    // 设置输出方法
+    // 设置输出方法：同时取消直接写入异步日志的路径
     static void setOutputFunc(OutputFunc func);
 
+    /**
+     * 按当前的记录格式写入日志头并开始消息，供不经过 Logger 对象的日志使用
+     * (日志线程格式化的延迟日志、异步日志自己输出的丢弃标记和运行指标等)，与 LOG_INFO 输出的记录格式相同
+     * tid 和 thread_name 为写日志的线程；stream 应为新建的流，写完消息后调用 finishRecord()
+     */
+    static void beginRecord(LogStream &stream, int64_t time, int tid, const char *thread_name, LogLevel level,
+                            const SourceFile &file, int line, const char *func_name);
+    // 结束 beginRecord() 开始的记录：补全结构、写入截断标记和换行，并计入截断统计
+    static void finishRecord(LogStream &stream);
+
     // 内部类: 日志消息的格式
     class Impl
     {
     public:
         using LogLevel = Logger::LogLevel;
-        Impl(LogLevel level, const SourceFile &file, int line);
+        // threshold 为所属模块的日志级别
+        Impl(LogLevel level, const SourceFile &file, int line, int threshold);
+        ~Impl();
+
+        /**
+         * 获取日志内容的内存：优先直接使用异步日志暂存队列中的空间
+         * ERROR/FATAL 先输出飞行记录器中的上下文，再预留自己的空间，保证上下文在这条日志之前
+         */
+        char *acquireStorage(LogLevel level);
+        // 该级别的日志是否只写入飞行记录器
+        static bool isRecorded(LogLevel level, int threshold);
 
         // 格式化时间
         void forMatTime();
         // 获取当前线程id
         void getThreadId();
+        // 结构化格式：把日志头写为字段
+        void formatFields();
+        // 日志头之后写入函数名和被限流跳过的次数，然后开始消息部分
+        void beginMessage(const char *func_name, uint64_t suppressed);
 
-        int64_t time_;     // 当前时间
-        LogStream stream_; // 输出流(其中有一个缓冲区)
+        int64_t time_;                   // 当前时间
+        LogStream::RecordFormat format_; // 记录的格式
+        AsyncLogging *async_;            // 日志内容直接写入了它的暂存队列，为空时通过 g_output_func 输出
+        char *owned_;                    // 嵌套使用 Logger 时自己分配的内存
+        bool recorded_;                  // 只写入飞行记录器
+        LogStream stream_;               // 输出流(指向上面获取的内存)
         LogLevel level_;   // 日志等级
         SourceFile file_;  // 文件名
         int line_;         // 当前行
     };
 
 private:
-    Impl impl_;            // Impl 对象
-    static bool is_async_; // 是否使用异步日志
+    Impl impl_; // Impl 对象
+};
+
+/**
+ * 一个模块(标签或者源文件)的日志级别
+ * 调用点第一次执行时通过宏中的静态引用取得所属模块的 slot，之后判断级别只需要一次 relaxed 原子读取
+ * 没有单独设置级别的模块跟随当前日志级别
+ */
+struct LogLevelSlot
+{
+    std::atomic<int> level;  // 模块的日志级别
+    std::atomic<int> lowest; // 需要构造 Logger 的最低级别：模块级别和飞行记录器级别中较低的一个
+    bool overridden;         // 是否单独设置了级别，只在注册表的锁内访问
+
+    // 返回模块的日志级别
+    int logLevel() const { return level.load(std::memory_order_relaxed); }
+    // 是否需要构造 Logger
+    bool enabled(int log_level) const { return lowest.load(std::memory_order_relaxed) <= log_level; }
 };
 
 // 全局变量：当前日志级别
-extern Logger::LogLevel g_log_level;
+extern std::atomic<Logger::LogLevel> g_log_level;
 // 返回当前日志级别
 inline Logger::LogLevel Logger::logLevel()
 {
-    return g_log_level;
+    return g_log_level.load(std::memory_order_relaxed);
+}
+
+// 全局变量：需要构造 Logger 的最低级别
+extern std::atomic<Logger::LogLevel> g_lowest_level;
+inline Logger::LogLevel Logger::lowestLevel()
+{
+    return g_lowest_level.load(std::memory_order_relaxed);
 }
 
-// 全局变量：是否使用异步日志
-extern bool g_is_async_;
+// 全局变量：时区偏移(秒)
+extern std::atomic<int> g_time_zone_offset;
+// 全局变量：日志记录的格式
+extern std::atomic<LogStream::RecordFormat> g_record_format;
+
+// 全局变量：异步日志后端
+extern AsyncLogging *g_async_logging;
+// 全局变量：分片的异步日志后端，设置后优先使用
+extern ShardedAsyncLogging *g_sharded_logging;
 // 设置为异步日志 
-inline void Logger::setAsync()
+inline void Logger::setAsync(AsyncLogging *async)
+{
+    g_async_logging = async;
+    g_sharded_logging = nullptr;
+}
+inline void Logger::setSharded(ShardedAsyncLogging *sharded)
 {
-    g_is_async_ = true;
+    g_sharded_logging = sharded;
+    g_async_logging = nullptr;
+}
+// 返回异步日志后端
+inline AsyncLogging *Logger::asyncLogging()
+{
+    if (g_sharded_logging)
+    {
+        return g_sharded_logging->shard();
+    }
+    return g_async_logging;
 }
 
 /**
@@ -104,6 +251,12 @@ inline void Logger::setAsync()
 // 设置当前日志级别
 #define SET_LOGLEVEL(x) Logger::setLogLevel(x);
 
+// 设置时区(相对UTC的偏移秒数)
+#define SET_TIMEZONE(x) Logger::setTimeZone(x);
+
+// 设置当前线程名
+#define SET_THREADNAME(x) Logger::setThreadName(x);
+
 // 设置为异步日志
 #define LOG_SET_ASYNC(x)                                                                       \
     if (x != 0)                                                                                \
@@ -111,21 +264,132 @@ inline void Logger::setAsync()
         static AsyncLogging g_async_;                                                          \
         Logger::setOutputFunc(                                                                 \
             [&](const LogStream::Buffer &buf) { g_async_.append(buf.data(), buf.length()); }); \
-        Logger::setAsync();                                                                    \
+        Logger::setAsync(&g_async_);                                                           \
+    }
+
+// 设置为异步日志，并且每个线程使用自己的暂存队列(延迟格式化的日志需要此模式)
+#define LOG_SET_ASYNC_STAGING(x)                                                               \
+    if (x != 0)                                                                                \
+    {                                                                                          \
+        static AsyncLogging g_async_(500, 20 * 1024 * 1024, true);                             \
+        Logger::setOutputFunc(                                                                 \
+            [&](const LogStream::Buffer &buf) { g_async_.append(buf.data(), buf.length()); }); \
+        Logger::setAsync(&g_async_);                                                           \
+    }
+
+// 设置为分片的异步日志：n 个日志线程，每个写自己的文件，用 logmerge 工具合并
+#define LOG_SET_ASYNC_SHARDED(n)                                                                 \
+    if (n > 0)                                                                                   \
+    {                                                                                            \
+        static ShardedAsyncLogging g_sharded_(n);                                                \
+        Logger::setOutputFunc(                                                                   \
+            [&](const LogStream::Buffer &buf) { g_sharded_.append(buf.data(), buf.length()); }); \
+        Logger::setSharded(&g_sharded_);                                                         \
     }
 
-#define LOG_TRACE                            \
-    if (Logger::logLevel() <= Logger::TRACE) \
-    (Logger(__FILE__, __LINE__, Logger::TRACE, __func__).stream())
+/**
+ * 编译期的最低日志级别：0~5 依次为 TRACE/DEBUG/INFO/WARN/ERROR/FATAL，默认为 0
+ * 低于它的日志宏不生成任何代码(参数表达式也不会求值)，例如 -DDDLOG_COMPILE_LEVEL=2 去掉 TRACE 和 DEBUG
+ */
+#ifndef DDLOG_COMPILE_LEVEL
+#define DDLOG_COMPILE_LEVEL 0
+#endif
+
+// 编译期被关闭的级别走空分支，else 之后的语句只做语法检查
+#define DDLOG_COMPILED_OUT_(level) \
+    if constexpr (static_cast<int>(Logger::level) < DDLOG_COMPILE_LEVEL) {} else
+
+// 调用点的源文件名：在编译期去掉目录并求出长度，输出时不再扫描 __FILE__
+#define DDLOG_CONSTANT_(x) std::integral_constant<int, (x)>::value
+#define DDLOG_SOURCE_FILE_                                                                          \
+    Logger::SourceFile(__FILE__, DDLOG_CONSTANT_(Logger::SourceFile::basenameOffset(__FILE__)),     \
+                       static_cast<int>(sizeof(__FILE__)) - 1)
+
+/**
+ * TRACE/DEBUG/INFO 按源文件的级别判断，可以用 Logger::setModuleLevel("xxx.cc", level) 单独设置
+ * 每个调用点用静态引用缓存所属文件的 slot，只在第一次执行时查找
+ */
+#define LOG_TRACE                                                                                   \
+    DDLOG_COMPILED_OUT_(TRACE)                                                                      \
+    if (static LogLevelSlot &log_slot_ = Logger::levelSlot(DDLOG_SOURCE_FILE_.file_);               \
+        log_slot_.enabled(Logger::TRACE))                                                           \
+    (Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::TRACE, __func__, log_slot_).stream())
+
+#define LOG_DEBUG                                                                                   \
+    DDLOG_COMPILED_OUT_(DEBUG)                                                                      \
+    if (static LogLevelSlot &log_slot_ = Logger::levelSlot(DDLOG_SOURCE_FILE_.file_);               \
+        log_slot_.enabled(Logger::DEBUG))                                                           \
+    (Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::DEBUG, __func__, log_slot_).stream())
+
+#define LOG_INFO                                                                                    \
+    DDLOG_COMPILED_OUT_(INFO)                                                                       \
+    if (static LogLevelSlot &log_slot_ = Logger::levelSlot(DDLOG_SOURCE_FILE_.file_);               \
+        log_slot_.enabled(Logger::INFO))                                                            \
+    (Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::INFO, __func__, log_slot_).stream())
+
+#define LOG_WARN                                                                                    \
+    DDLOG_COMPILED_OUT_(WARN) Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::WARN, __func__).stream()
+#define LOG_ERROR                                                                                   \
+    DDLOG_COMPILED_OUT_(ERROR) Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::ERROR, __func__).stream()
+#define LOG_FATAL                                                                                   \
+    DDLOG_COMPILED_OUT_(FATAL) Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::FATAL, __func__).stream()
+
+/**
+ * 按标签输出：level 为 TRACE/DEBUG/INFO/WARN/ERROR/FATAL，例如 LOG_TAG(DEBUG, "net") << "recv " << n;
+ * 标签的级别用 Logger::setModuleLevel("net", level) 单独设置，WARN 及以上的日志总是输出
+ */
+#define LOG_TAG(level, tag)                                                                         \
+    DDLOG_COMPILED_OUT_(level)                                                                      \
+    if (static LogLevelSlot &log_slot_ = Logger::levelSlot(tag);                                    \
+        Logger::level >= Logger::WARN || log_slot_.enabled(Logger::level))                          \
+    (Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::level, __func__, log_slot_).stream())
+
+/**
+ * 带字段的日志：level 为 TRACE/DEBUG/INFO/WARN/ERROR/FATAL，例如
+ *     LOG_KV(INFO, "order filled").kv("order_id", id).kv("latency_us", latency);
+ * 级别的判断与 LOG_TRACE 等宏相同；也可以直接 LOG_INFO.kv("key", value)
+ */
+#define LOG_KV(level, message)                                                                      \
+    DDLOG_COMPILED_OUT_(level)                                                                      \
+    if (static LogLevelSlot &log_slot_ = Logger::levelSlot(DDLOG_SOURCE_FILE_.file_);               \
+        Logger::level >= Logger::WARN || log_slot_.enabled(Logger::level))                          \
+    (Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::level, __func__, log_slot_).stream() << message)
 
-#define LOG_DEBUG                            \
-    if (Logger::logLevel() <= Logger::DEBUG) \
-    (Logger(__FILE__, __LINE__, Logger::DEBUG, __func__).stream())
+/**
+ * 编译期解析格式串：level 为 TRACE/DEBUG/INFO/WARN/ERROR/FATAL，例如 LOG_INFOF("order {} filled at {}", id, price);
+ * 级别的判断与 LOG_TRACE 等宏相同，格式串必须是字符串字面量，见 logformat.h
+ */
+#define LOG_FORMAT_(level, fmt, ...)                                                                \
+    DDLOG_COMPILED_OUT_(level)                                                                      \
+    if (static LogLevelSlot &log_slot_ = Logger::levelSlot(DDLOG_SOURCE_FILE_.file_);               \
+        Logger::level >= Logger::WARN || log_slot_.enabled(Logger::level))                          \
+    LOG_FORMAT_TO(Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::level, __func__, log_slot_).stream(), \
+                  fmt, ##__VA_ARGS__)
 
-#define LOG_INFO                            \
-    if (Logger::logLevel() <= Logger::INFO) \
-    (Logger(__FILE__, __LINE__, Logger::INFO, __func__).stream())
+#define LOG_TRACEF(fmt, ...) LOG_FORMAT_(TRACE, fmt, ##__VA_ARGS__)
+#define LOG_DEBUGF(fmt, ...) LOG_FORMAT_(DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFOF(fmt, ...) LOG_FORMAT_(INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARNF(fmt, ...) LOG_FORMAT_(WARN, fmt, ##__VA_ARGS__)
+#define LOG_ERRORF(fmt, ...) LOG_FORMAT_(ERROR, fmt, ##__VA_ARGS__)
+#define LOG_FATALF(fmt, ...) LOG_FORMAT_(FATAL, fmt, ##__VA_ARGS__)
+
+/**
+ * 限流和采样：level 为 TRACE/DEBUG/INFO/WARN/ERROR/FATAL，例如 LOG_EVERY_N(WARN, 100) << "queue full";
+ * 每个调用点有自己的静态状态，先判断级别，再判断是否限流；被跳过的调用不构造 Logger
+ * 输出的日志中带有 "(suppressed N) "，N 为上次输出之后被跳过的次数
+ */
+#define LOG_RATE_LIMITED_(level, site_type, arg)                                                    \
+    DDLOG_COMPILED_OUT_(level)                                                                      \
+    if (static LogLevelSlot &log_slot_ = Logger::levelSlot(DDLOG_SOURCE_FILE_.file_);               \
+        Logger::level >= Logger::WARN || log_slot_.enabled(Logger::level))                          \
+        if (static site_type log_site_; LogSiteDecision log_decision_ = log_site_.check(arg))       \
+    (Logger(DDLOG_SOURCE_FILE_, __LINE__, Logger::level, __func__, log_slot_, log_decision_.suppressed).stream())
 
-#define LOG_WARN logger(__FILE__, __LINE__, Logger::WARN, __func__).stream()
-#define LOG_ERROR logger(__FILE__, __LINE__, Logger::ERROR, __func__).stream()
-#define LOG_FATAL logger(__FILE__, __LINE__, Logger::FATAL, __func__).stream()
+// 每 n 次输出一次
+#define LOG_EVERY_N(level, n) LOG_RATE_LIMITED_(level, LogEveryN, n)
+// 只输出前 n 次
+#define LOG_FIRST_N(level, n) LOG_RATE_LIMITED_(level, LogFirstN, n)
+// 每 ms 毫秒最多输出一次
+#define LOG_EVERY_T(level, ms) LOG_RATE_LIMITED_(level, LogEveryT, ms)
+// 以概率 p (0~1) 输出
+#define LOG_SAMPLED(level, p) LOG_RATE_LIMITED_(level, LogSampled, p)
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "timestamp.h"
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * 调用点的限流和采样状态：由 LOG_EVERY_N / LOG_FIRST_N / LOG_EVERY_T / LOG_SAMPLED 在调用点定义为静态变量
+ * 被跳过的调用只做一次原子操作(或者读一次时钟)，不会构造 Logger
+ * 被跳过的次数在下一条输出的日志中给出
+ * 构造函数都是 constexpr：静态变量在编译期完成初始化，调用点不需要检查初始化保护
+ */
+
+// 一次判断的结果：是否输出，以及上次输出之后被跳过的次数
+struct LogSiteDecision
+{
+    bool emit;
+    uint64_t suppressed;
+
+    explicit operator bool() const { return emit; }
+};
+
+// 每 n 次输出一次(第 1、n+1、2n+1... 次)
+class LogEveryN : noncopyable
+{
+public:
+    constexpr LogEveryN() : count_(0) {}
+
+    LogSiteDecision check(uint64_t n)
+    {
+        uint64_t count = count_.fetch_add(1, std::memory_order_relaxed);
+        if (n > 1 && count % n != 0)
+        {
+            return LogSiteDecision{false, 0};
+        }
+        return LogSiteDecision{true, count == 0 || n <= 1 ? 0 : n - 1};
+    }
+
+private:
+    std::atomic<uint64_t> count_;
+};
+
+// 只输出前 n 次
+class LogFirstN : noncopyable
+{
+public:
+    constexpr LogFirstN() : count_(0) {}
+
+    LogSiteDecision check(uint64_t n)
+    {
+        // 输出 n 次之后不再修改计数，避免多个线程反复写同一个缓存行
+        if (count_.load(std::memory_order_relaxed) >= n)
+        {
+            return LogSiteDecision{false, 0};
+        }
+        return LogSiteDecision{count_.fetch_add(1, std::memory_order_relaxed) < n, 0};
+    }
+
+private:
+    std::atomic<uint64_t> count_;
+};
+
+// 每 ms 毫秒最多输出一次：使用粗粒度时钟，间隔小于一个时钟节拍时按节拍计算
+class LogEveryT : noncopyable
+{
+public:
+    constexpr LogEveryT() : next_(0), suppressed_(0) {}
+
+    LogSiteDecision check(int64_t ms)
+    {
+        int64_t now = Timestamp::coarseMonotonicNanos();
+        int64_t next = next_.load(std::memory_order_relaxed);
+        // 多个线程同时到期时只有一个能输出
+        if (now < next || !next_.compare_exchange_strong(next, now + ms * 1000000, std::memory_order_relaxed))
+        {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return LogSiteDecision{false, 0};
+        }
+        return LogSiteDecision{true, suppressed_.exchange(0, std::memory_order_relaxed)};
+    }
+
+private:
+    std::atomic<int64_t> next_;        // 下一次允许输出的时间
+    std::atomic<uint64_t> suppressed_; // 上次输出之后被跳过的次数
+};
+
+// 以概率 p 输出：每个线程有自己的随机数发生器(xorshift)
+class LogSampled : noncopyable
+{
+public:
+    constexpr LogSampled() : suppressed_(0) {}
+
+    LogSiteDecision check(double p)
+    {
+        // 取高 32 位与 p * 2^32 比较
+        if (static_cast<double>(random() >> 32) >= p * 4294967296.0)
+        {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return LogSiteDecision{false, 0};
+        }
+        return LogSiteDecision{true, suppressed_.exchange(0, std::memory_order_relaxed)};
+    }
+
+private:
+    static uint64_t random()
+    {
+        // 用线程局部变量的地址作为种子，不同线程的序列不同
+        thread_local uint64_t t_state = reinterpret_cast<uintptr_t>(&t_state) | 1;
+        t_state ^= t_state << 13;
+        t_state ^= t_state >> 7;
+        t_state ^= t_state << 17;
+        return t_state;
+    }
+
+    std::atomic<uint64_t> suppressed_; // 上次输出之后被跳过的次数
+};
@@ -1,66 +1,162 @@
 #include "logstream.h"
 
 #include <algorithm>
+#include <charconv>
+#include <cmath>
 #include <stdint.h>
 
-const char digits[] = "9876543210123456789"; // 保存数字
-const char *zero = digits + 9;               // 零所在的位置
-const char digitsHex[] = "0123456789ABCDEF"; // 十六进制
+// 两位一组的数字表："00" "01" ... "99"
+static const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+static const char digitsHex[] = "0123456789ABCDEF"; // 十六进制
 
-// Efficient Integer to String Conversions, by Matthew Wilson.
-// 将 int类型 转为 字符串类型 的高效函数
-template <class T>
-size_t convert(char buf[], T value)
+int digitCount(uint64_t value)
 {
-    T i = value;
-    char *p = buf;
+    // 每次比较四个数量级，避免逐位除法
+    int n = 1;
+    for (;;)
+    {
+        if (value < 10)
+            return n;
+        if (value < 100)
+            return n + 1;
+        if (value < 1000)
+            return n + 2;
+        if (value < 10000)
+            return n + 3;
+        value /= 10000;
+        n += 4;
+    }
+}
 
-    do
+// 已知位数 n 时从右向左写入，每次写两位，不需要最后再反转
+static inline void writeDigits(char *end, uint64_t value)
+{
+    while (value >= 100)
     {
-        int lsd = static_cast<int>(i % 10); // 获得个位
-        i /= 10;                            // 去除个位
-        *p++ = zero[lsd];                   // 得到数字对应的字符
-    } while (i != 0);
+        unsigned index = static_cast<unsigned>(value % 100) * 2;
+        value /= 100;
+        end -= 2;
+        memcpy(end, kDigitPairs + index, 2);
+    }
+    if (value >= 10)
+    {
+        memcpy(end - 2, kDigitPairs + value * 2, 2);
+    }
+    else
+    {
+        *(end - 1) = static_cast<char>('0' + value);
+    }
+}
+
+size_t convertDecimal(char buf[], uint64_t value)
+{
+    int n = digitCount(value);
+    writeDigits(buf + n, value);
+    return static_cast<size_t>(n);
+}
 
+size_t convertPadded(char buf[], uint64_t value, int width, char fill)
+{
+    int n = digitCount(value);
+    int pad = width > n ? width - n : 0;
+    memset(buf, fill, pad);
+    writeDigits(buf + pad + n, value);
+    return static_cast<size_t>(pad + n);
+}
+
+// 将 int类型 转为 字符串类型 的高效函数
+template <class T>
+size_t convert(char buf[], T value)
+{
     if (value < 0)
     {
-        *p++ = '-'; // 如果是负数，加上 - 号
+        // 先转成无符号数再取反，避免最小负数溢出
+        *buf = '-';
+        return convertDecimal(buf + 1, 0 - static_cast<uint64_t>(value)) + 1;
     }
-
-    *p = '\0';            // 末尾加上 \0
-    std::reverse(buf, p); // 将 \0 之前的字符反转
-    return p - buf;       // 返回字符串长度
+    return convertDecimal(buf, static_cast<uint64_t>(value));
 }
 
 // 将 int类型 转为十六进制的 字符串类型
 size_t convertHex(char buf[], uintptr_t value)
 {
-    uintptr_t i = value;
-    char *p = buf;
-
+    // 先算出位数，再从右向左写入
+    int n = 1;
+    for (uintptr_t i = value >> 4; i != 0; i >>= 4)
+    {
+        ++n;
+    }
+    char *p = buf + n;
     do
     {
-        int lsd = static_cast<int>(i % 16);
-        i /= 16;
-        *p++ = digitsHex[lsd];
-    } while (i != 0);
+        *--p = digitsHex[value & 0xF];
+        value >>= 4;
+    } while (value != 0);
+    return static_cast<size_t>(n);
+}
+
+size_t convertSigned(char buf[], int64_t value)
+{
+    return convert(buf, value);
+}
 
-    *p = '\0';
-    std::reverse(buf, p);
-    return p - buf;
+size_t convertPointer(char buf[], const void *p)
+{
+    buf[0] = '0';
+    buf[1] = 'x';
+    return convertHex(buf + 2, reinterpret_cast<uintptr_t>(p)) + 2;
 }
 
-// 把整型按照T类型格式化到缓冲区中
+// std::to_chars 与 locale 无关，也不会像 "%.12g" 那样丢失精度
 template <class T>
-void LogStream::formatInteger(T v)
+static size_t convertFloatingImpl(char buf[], T value)
 {
-    if (buffer_.avail() >= kMaxNumericSize)
+    std::to_chars_result result = std::to_chars(buf, buf + kMaxNumericSize, value);
+    return result.ec == std::errc() ? static_cast<size_t>(result.ptr - buf) : 0;
+}
+
+size_t convertFloating(char buf[], double value)
+{
+    return convertFloatingImpl(buf, value);
+}
+
+size_t convertFloating(char buf[], float value)
+{
+    return convertFloatingImpl(buf, value);
+}
+
+// 空间足够(或者可以扩展)时直接写入缓冲区，否则先写到栈上，再写入能放下的部分
+template <class Convert>
+void LogStream::appendNumeric(Convert convert)
+{
+    if (buffer_.ensure(kMaxNumericSize))
+    {
+        buffer_.add(convert(buffer_.current()));
+    }
+    else
     {
-        size_t len = convert(buffer_.current(), v);
-        buffer_.add(len);
+        char buf[kMaxNumericSize];
+        buffer_.append(buf, static_cast<int>(convert(buf)));
     }
 }
 
+// 把整型按照T类型格式化到缓冲区中
+template <class T>
+void LogStream::formatInteger(T v)
+{
+    appendNumeric([v](char *p) { return convert(p, v); });
+}
+
 // 重载 << 运算符
 LogStream &LogStream::operator<<(short v)
 {
@@ -69,7 +165,7 @@ LogStream &LogStream::operator<<(short v)
 }
 LogStream &LogStream::operator<<(unsigned short v)
 {
-    *this << static_cast<unsigned short>(v);
+    *this << static_cast<unsigned int>(v);
     return *this;
 }
 LogStream &LogStream::operator<<(int v)
@@ -106,23 +202,612 @@ LogStream &LogStream::operator<<(unsigned long long v)
 LogStream &LogStream::operator<<(const void *p)
 {
     // 如果是指针，就转为16进制的形式
-    uintptr_t v = reinterpret_cast<uintptr_t>(p);
-    if (buffer_.avail() > kMaxNumericSize)
+    appendNumeric([p](char *dest) { return convertPointer(dest, p); });
+    return *this;
+}
+LogStream &LogStream::operator<<(Integer v)
+{
+    // 宽度不能超过数值的预留空间
+    int width = std::min(std::max(v.width, 0), kMaxNumericSize - 2);
+    appendNumeric([&v, width](char *p) {
+        char digits[kMaxNumericSize];
+        int n = static_cast<int>(v.hex ? convertHex(digits, static_cast<uintptr_t>(v.magnitude))
+                                       : convertDecimal(digits, v.magnitude));
+        int sign = v.negative ? 1 : 0;
+        int pad = width > n + sign ? width - n - sign : 0;
+        if (v.fill == '0')
+        {
+            // 补零时符号在最前面："-0042"
+            if (sign)
+            {
+                *p++ = '-';
+            }
+            memset(p, '0', pad);
+            p += pad;
+        }
+        else
+        {
+            // 补空格时符号紧挨着数字："  -42"
+            memset(p, v.fill, pad);
+            p += pad;
+            if (sign)
+            {
+                *p++ = '-';
+            }
+        }
+        memcpy(p, digits, n);
+        return static_cast<size_t>(sign + pad + n);
+    });
+    return *this;
+}
+
+// 把浮点数按最短且能精确还原的格式写入缓冲区中
+template <class T>
+void LogStream::formatFloating(T v)
+{
+    appendNumeric([v](char *p) { return convertFloating(p, v); });
+}
+
+LogStream &LogStream::operator<<(float v)
+{
+    formatFloating(v);
+    return *this;
+}
+LogStream &LogStream::operator<<(double v)
+{
+    formatFloating(v);
+    return *this;
+}
+
+LogStream &LogStream::operator<<(Fixed v)
+{
+    // 数值很大时定点格式可能放不下，此时退回最短格式
+    if (buffer_.ensure(kMaxNumericSize))
     {
-        char *buf = buffer_.current();
-        buf[0] = '0';
-        buf[1] = 'x';
-        size_t len = convertHex(buf + 2, v);
-        buffer_.add(len + 2);
+        char *begin = buffer_.current();
+        int precision = std::min(std::max(v.precision, 0), 17);
+        std::to_chars_result result = std::to_chars(begin, begin + kMaxNumericSize, v.value,
+                                                    std::chars_format::fixed, precision);
+        if (result.ec == std::errc())
+        {
+            buffer_.add(result.ptr - begin);
+            return *this;
+        }
     }
+    formatFloating(v.value);
     return *this;
 }
-LogStream &LogStream::operator<<(double v)
+
+namespace
+{
+// 每个字节都是 c 的 64 位整数
+inline uint64_t broadcast(uint8_t c)
+{
+    return 0x0101010101010101ULL * c;
+}
+
+// x 中小于 n 的字节(n <= 0x80)，最高位置 1。更高的字节可能误报，但最低的一个总是准确的
+inline uint64_t bytesLess(uint64_t x, uint8_t n)
+{
+    return (x - broadcast(n)) & ~x & broadcast(0x80);
+}
+
+// x 中等于 c 的字节，最高位置 1(同样只保证最低的一个准确)
+inline uint64_t bytesEqual(uint64_t x, uint8_t c)
+{
+    return bytesLess(x ^ broadcast(c), 1);
+}
+
+inline bool needsEscape(unsigned char c, bool quote_space)
+{
+    return c < 0x20 || c == '"' || c == '\\' || (quote_space && (c == ' ' || c == '='));
+}
+
+const char kHexDigits[] = "0123456789abcdef";
+
+// 转义后的长度：需要转义的字符 c
+inline size_t escapeSize(unsigned char c)
+{
+    return c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t' ? 2 : 6;
+}
+} // namespace
+
+size_t findEscape(const char *data, size_t len, bool quote_space)
+{
+    size_t i = 0;
+    // 每次检查 8 个字节(小端序：最低的字节在前)
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t x;
+        memcpy(&x, data + i, sizeof(x));
+        uint64_t mask = bytesLess(x, quote_space ? 0x21 : 0x20) | bytesEqual(x, '"') | bytesEqual(x, '\\');
+        if (quote_space)
+        {
+            mask |= bytesEqual(x, '=');
+        }
+        if (mask != 0)
+        {
+            return i + static_cast<size_t>(__builtin_ctzll(mask)) / 8;
+        }
+    }
+    for (; i < len; ++i)
+    {
+        if (needsEscape(static_cast<unsigned char>(data[i]), quote_space))
+        {
+            return i;
+        }
+    }
+    return len;
+}
+
+size_t escapedLength(const char *data, size_t len)
+{
+    size_t total = len;
+    for (size_t i = findEscape(data, len); i < len; i += 1 + findEscape(data + i + 1, len - i - 1))
+    {
+        total += escapeSize(static_cast<unsigned char>(data[i])) - 1;
+    }
+    return total;
+}
+
+size_t convertEscaped(char dest[], const char *data, size_t len)
+{
+    char *p = dest;
+    while (len > 0)
+    {
+        // 整段复制不需要转义的部分
+        size_t run = findEscape(data, len);
+        memcpy(p, data, run);
+        p += run;
+        if (run == len)
+        {
+            break;
+        }
+        unsigned char c = static_cast<unsigned char>(data[run]);
+        *p++ = '\\';
+        switch (c)
+        {
+        case '"':
+        case '\\':
+            *p++ = static_cast<char>(c);
+            break;
+        case '\n':
+            *p++ = 'n';
+            break;
+        case '\r':
+            *p++ = 'r';
+            break;
+        case '\t':
+            *p++ = 't';
+            break;
+        default:
+            memcpy(p, "u00", 3);
+            p[3] = kHexDigits[c >> 4];
+            p[4] = kHexDigits[c & 0xF];
+            p += 5;
+            break;
+        }
+        data += run + 1;
+        len -= run + 1;
+    }
+    return static_cast<size_t>(p - dest);
+}
+
+// 结束记录需要的空间：JSON 为 "}\n，logfmt 为 "\n
+static const int kRecordTail = 3;
+
+void LogStream::beginMessage()
+{
+    if (format_ == kText)
+    {
+        return;
+    }
+    // 同时保留消息的结束引号
+    buffer_.reserveTail(kRecordTail + 1);
+    buffer_.append(format_ == kJson ? ",\"msg\":\"" : " msg=\"", format_ == kJson ? 8 : 6);
+    message_ = buffer_.length();
+}
+
+void LogStream::endMessage()
+{
+    int offset = message_;
+    message_ = -1;
+    buffer_.releaseTail(1);
+    size_t len = static_cast<size_t>(buffer_.length() - offset);
+    char *begin = buffer_.current() - len;
+    size_t first = findEscape(begin, len);
+    if (first < len)
+    {
+        // 先按展开后的长度扩展缓冲区，扩展后消息的位置可能改变
+        size_t expanded = escapedLength(begin + first, len - first) - (len - first);
+        buffer_.ensure(static_cast<int>(expanded) + 2);
+        begin = buffer_.current() - len;
+        // 从第一个需要转义的字符开始计算展开的长度，放不下时截断消息(留出结束引号的空间)
+        size_t capacity = len + static_cast<size_t>(buffer_.avail() > 2 ? buffer_.avail() - 2 : 0);
+        size_t extra = 0;
+        size_t end = len;
+        for (size_t i = first; i < len; i += 1 + findEscape(begin + i + 1, len - i - 1))
+        {
+            size_t grow = escapeSize(static_cast<unsigned char>(begin[i])) - 1;
+            if (i + 1 + extra + grow > capacity)
+            {
+                end = i;
+                break;
+            }
+            extra += grow;
+        }
+        if (end + extra > capacity)
+        {
+            end = capacity - extra;
+        }
+        // 从后向前原地展开，目标位置总是不小于源位置
+        char *dest = begin + end + extra;
+        for (size_t i = end; i > first; --i)
+        {
+            unsigned char c = static_cast<unsigned char>(begin[i - 1]);
+            if (!needsEscape(c, false))
+            {
+                *--dest = static_cast<char>(c);
+                continue;
+            }
+            char escaped[6];
+            size_t n = convertEscaped(escaped, begin + i - 1, 1);
+            dest -= n;
+            memcpy(dest, escaped, n);
+        }
+        buffer_.truncate(static_cast<int>(begin + end + extra - buffer_.data()));
+        buffer_.discard(static_cast<int>(len - end));
+    }
+    buffer_.append("\"", 1);
+}
+
+void LogStream::endRecord()
+{
+    if (format_ != kText)
+    {
+        if (message_ >= 0)
+        {
+            endMessage();
+        }
+        buffer_.releaseTail(kRecordTail);
+    }
+    // 有内容被截断时注明截断的字节数，使用到达上限时预留的空间
+    if (int truncated = buffer_.truncated())
+    {
+        buffer_.releaseTruncateReserve();
+        if (format_ == kText)
+        {
+            *this << " ...(truncated " << truncated << " bytes)";
+        }
+        else
+        {
+            kv("truncated", truncated);
+        }
+    }
+    if (format_ == kJson)
+    {
+        buffer_.append("}\n", 2);
+    }
+    else
+    {
+        buffer_.append("\n", 1);
+    }
+}
+
+char *LogStream::beginField(const char *key, int value_size)
+{
+    if (message_ >= 0)
+    {
+        endMessage();
+    }
+    int key_len = static_cast<int>(strlen(key));
+    if (!buffer_.ensure(key_len + 4 + value_size))
+    {
+        // 放不下时丢弃整个字段
+        buffer_.discard(key_len + 2 + value_size);
+        return nullptr;
+    }
+    char *p = buffer_.current();
+    if (format_ == kJson)
+    {
+        // ,"key":
+        *p++ = ',';
+        *p++ = '"';
+        memcpy(p, key, key_len);
+        p += key_len;
+        *p++ = '"';
+        *p++ = ':';
+    }
+    else
+    {
+        *p++ = ' ';
+        memcpy(p, key, key_len);
+        p += key_len;
+        *p++ = '=';
+    }
+    buffer_.add(p - buffer_.current());
+    return p;
+}
+
+// 字符串值是否需要加引号
+bool LogStream::quoteValue(const char *data, int len) const
+{
+    return format_ == kJson || len == 0 || findEscape(data, static_cast<size_t>(len), true) < static_cast<size_t>(len);
+}
+
+int LogStream::valueSize(const char *data, int len) const
+{
+    return quoteValue(data, len) ? static_cast<int>(escapedLength(data, static_cast<size_t>(len))) + 2 : len;
+}
+
+void LogStream::appendValue(const char *data, int len)
+{
+    if (!quoteValue(data, len))
+    {
+        buffer_.append(data, len);
+        return;
+    }
+    size_t size = static_cast<size_t>(len);
+    if (buffer_.ensure(static_cast<int>(escapedLength(data, size)) + 2))
+    {
+        char *p = buffer_.current();
+        *p = '"';
+        size_t n = convertEscaped(p + 1, data, size);
+        p[n + 1] = '"';
+        buffer_.add(n + 2);
+    }
+    else
+    {
+        buffer_.discard(len);
+    }
+}
+
+LogStream &LogStream::kv(const char *key, bool v)
+{
+    if (beginField(key, 5))
+    {
+        buffer_.append(v ? "true" : "false", v ? 4 : 5);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, char v)
+{
+    if (beginField(key, 8))
+    {
+        appendValue(&v, 1);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, int v)
+{
+    if (beginField(key, kMaxNumericSize))
+    {
+        formatInteger(v);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, unsigned int v)
+{
+    if (beginField(key, kMaxNumericSize))
+    {
+        formatInteger(v);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, long v)
+{
+    if (beginField(key, kMaxNumericSize))
+    {
+        formatInteger(v);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, unsigned long v)
+{
+    if (beginField(key, kMaxNumericSize))
+    {
+        formatInteger(v);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, long long v)
+{
+    if (beginField(key, kMaxNumericSize))
+    {
+        formatInteger(v);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, unsigned long long v)
+{
+    if (beginField(key, kMaxNumericSize))
+    {
+        formatInteger(v);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, double v)
 {
-    if (buffer_.avail() > kMaxNumericSize)
+    if (beginField(key, kMaxNumericSize + 2))
     {
-        int len = snprintf(buffer_.current(), kMaxNumericSize, "%.12g", v);
-        buffer_.add(len);
+        // JSON 没有 inf 和 nan，按字符串输出
+        bool quote = format_ == kJson && !std::isfinite(v);
+        char *p = buffer_.current();
+        size_t n = convertFloating(p + (quote ? 1 : 0), v);
+        if (quote)
+        {
+            p[0] = '"';
+            p[n + 1] = '"';
+            n += 2;
+        }
+        buffer_.add(n);
     }
     return *this;
 }
+
+LogStream &LogStream::kv(const char *key, const void *v)
+{
+    if (beginField(key, kMaxNumericSize + 2))
+    {
+        char *p = buffer_.current();
+        bool quote = format_ == kJson;
+        size_t n = convertPointer(p + (quote ? 1 : 0), v);
+        if (quote)
+        {
+            p[0] = '"';
+            p[n + 1] = '"';
+            n += 2;
+        }
+        buffer_.add(n);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, const char *v)
+{
+    if (!v)
+    {
+        v = "(null)";
+    }
+    int len = static_cast<int>(strlen(v));
+    if (beginField(key, valueSize(v, len)))
+    {
+        appendValue(v, len);
+    }
+    return *this;
+}
+
+LogStream &LogStream::kv(const char *key, const std::string &v)
+{
+    int len = static_cast<int>(v.size());
+    if (beginField(key, valueSize(v.data(), len)))
+    {
+        appendValue(v.data(), len);
+    }
+    return *this;
+}
+
+namespace
+{
+// 线程缓存的扩展内存：每个线程保留一块不太大的内存，重复使用
+// 同一线程同时有多个流需要扩展时(例如日志参数中又写了日志)，后来的流单独分配
+struct OverflowBlock
+{
+    ~OverflowBlock() { delete[] data; }
+
+    char *data = nullptr;
+    int size = 0;
+    bool in_use = false;
+};
+
+// 不超过这个大小的扩展内存在线程中缓存，更大的用完即释放
+const int kCachedBlockSize = 64 * 1024;
+
+thread_local OverflowBlock t_overflow_block;
+} // namespace
+
+void StreamBuffer::setLimit(int limit)
+{
+    limit_ = std::max(limit, size_);
+    if (size_ >= limit_)
+    {
+        // 不能扩展：直接预留截断标记的空间
+        reserveTail(kTruncateReserve);
+    }
+}
+
+void StreamBuffer::releaseTruncateReserve()
+{
+    if (limit_ > 0 && size_ >= limit_)
+    {
+        limit_ = 0;
+        releaseTail(kTruncateReserve);
+    }
+}
+
+void StreamBuffer::appendSlow(const char *buf, int len)
+{
+    if (!grow(len))
+    {
+        // 写入能放下的部分，其余计入截断的字节数
+        int n = std::max(std::min(len, avail() - 1), 0);
+        truncated_ += len - n;
+        len = n;
+    }
+    memcpy(cur_, buf, len);
+    cur_ += len;
+}
+
+bool StreamBuffer::grow(int len)
+{
+    if (size_ >= limit_)
+    {
+        return false;
+    }
+    // 按 2 的幂扩展，最多到 limit_；到达上限时还要预留截断标记的空间
+    int used = length();
+    int64_t needed = static_cast<int64_t>(used) + len + 1 + tail_ + kTruncateReserve;
+    int64_t size = static_cast<int64_t>(size_) * 2;
+    while (size < needed)
+    {
+        size *= 2;
+    }
+    int new_size = static_cast<int>(std::min<int64_t>(size, limit_));
+
+    char *block = acquireBlock(&new_size);
+    new_size = std::min(new_size, limit_);
+    memcpy(block, data_, used);
+    if (block_)
+    {
+        releaseBlock(block_);
+    }
+    block_ = block;
+    data_ = block;
+    cur_ = block + used;
+    size_ = new_size;
+    if (size_ >= limit_)
+    {
+        tail_ += kTruncateReserve;
+    }
+    end_ = data_ + size_ - tail_;
+    return avail() > len;
+}
+
+char *StreamBuffer::acquireBlock(int *size)
+{
+    OverflowBlock &cached = t_overflow_block;
+    if (cached.in_use || *size > kCachedBlockSize)
+    {
+        return new char[*size];
+    }
+    if (cached.size < *size)
+    {
+        delete[] cached.data;
+        cached.data = new char[kCachedBlockSize];
+        cached.size = kCachedBlockSize;
+    }
+    cached.in_use = true;
+    *size = cached.size;
+    return cached.data;
+}
+
+void StreamBuffer::releaseBlock(char *block)
+{
+    OverflowBlock &cached = t_overflow_block;
+    if (block == cached.data)
+    {
+        cached.in_use = false;
+    }
+    else
+    {
+        delete[] block;
+    }
+}
@@ -2,11 +2,46 @@
 
 #include "noncopyable.h"
 
+#include <memory>
 #include <string>
 #include <string.h> // memcpy
+#include <stdint.h>
+#include <type_traits>
 
 const int kSmallBuffer = 4000;        // 小Buffer大小：供LogStream使用
 const int KLargeBuffer = 4000 * 1000; // 大Buffer大小：供AsyncLogging使用
+const int kMaxNumericSize = 32;       // 一个数值格式化后的最大长度
+
+/**
+ * 整数格式化：两位一组查表，先算出位数再从右向左写入
+ * 供 LogStream、线程id和时间格式化共用，都不会在末尾写入 \0
+ */
+// 返回十进制位数
+int digitCount(uint64_t value);
+// 十进制，返回长度
+size_t convertDecimal(char buf[], uint64_t value);
+// 十进制，位数不足 width 时在左边用 fill 补齐，返回长度
+size_t convertPadded(char buf[], uint64_t value, int width, char fill = '0');
+// 十六进制(大写)，返回长度
+size_t convertHex(char buf[], uintptr_t value);
+// 有符号十进制，返回长度
+size_t convertSigned(char buf[], int64_t value);
+// 指针："0x" 加十六进制地址，返回长度
+size_t convertPointer(char buf[], const void *p);
+// 浮点数：最短且能精确还原的格式，最多写入 kMaxNumericSize 字节，失败时返回 0
+size_t convertFloating(char buf[], double value);
+size_t convertFloating(char buf[], float value);
+
+/**
+ * 字符串转义(JSON 规则)：" 和 \ 加反斜杠，控制字符转为 \n \t 或 \u00XX，其余字节(包括 UTF-8)原样输出
+ * 扫描时每次检查 8 个字节，没有需要转义的字符时整段复制
+ */
+// 返回第一个需要转义的字符的位置，没有时返回 len；quote_space 为 true 时空格和 = 也算在内(logfmt 判断是否需要引号)
+size_t findEscape(const char *data, size_t len, bool quote_space = false);
+// 返回转义后的长度
+size_t escapedLength(const char *data, size_t len);
+// 转义后写入 dest(需要 escapedLength() 字节)，返回长度
+size_t convertEscaped(char dest[], const char *data, size_t len);
 
 /**
  * 缓冲区类
@@ -34,7 +69,7 @@ public:
     // 返回缓冲区头指针
     const char *data() const { return data_; }
     // 返回已使用长度
-    int length() const { return static_cast<int>(cur - data_); }
+    int length() const { return static_cast<int>(cur_ - data_); }
     // 当前指针向后移动 len 个位置
     void add(size_t len) { cur_ += len; }
     // 返回当前位置指针
@@ -42,7 +77,7 @@ public:
     // 重置缓冲区
     void reset() { cur_ = data_; }
     // 将缓冲区置空
-    void bzero() { memset(); }
+    void bzero() { memset(data_, 0, sizeof(data_)); }
     // 返回缓冲区剩余大小
     int avail() const { return static_cast<int>(end() - cur_); }
 
@@ -54,6 +89,103 @@ private:
     char *cur_;       // 指向当前位置指针
 };
 
+/**
+ * 指向外部内存的缓冲区类，接口与 LogBuffer 相同
+ * LogStream 用它直接写入异步日志的暂存队列，省去一次复制
+ * 用 setLimit() 允许扩展时，空间不足后换到更大的内存(优先使用线程缓存的内存块)，最多扩展到 limit 字节；
+ * 放不下的部分被截断，截断的字节数由 truncated() 给出，到达上限后在末尾预留写截断标记的空间
+ */
+class StreamBuffer : noncopyable
+{
+public:
+    // 到达上限后为截断标记预留的空间
+    static const int kTruncateReserve = 48;
+
+    StreamBuffer(char *data, int size)
+        : data_(data), cur_(data), end_(data + size), size_(size), tail_(0), limit_(0), truncated_(0), block_(nullptr)
+    {
+    }
+    ~StreamBuffer()
+    {
+        if (block_)
+        {
+            releaseBlock(block_);
+        }
+    }
+
+    // 末尾添加
+    void append(const char *buf, int len)
+    {
+        // 如果还有空间，将buf加入缓冲区
+        if (avail() > len)
+        {
+            memcpy(cur_, buf, len);
+            cur_ += len;
+        }
+        else
+        {
+            appendSlow(buf, len);
+        }
+    }
+    // 确保还能写入 len 字节，必要时扩展；返回 false 时不能写入
+    bool ensure(int len) { return avail() > len || grow(len); }
+
+    // 返回缓冲区头指针
+    const char *data() const { return data_; }
+    // 返回已使用长度
+    int length() const { return static_cast<int>(cur_ - data_); }
+    // 当前指针向后移动 len 个位置
+    void add(size_t len) { cur_ += len; }
+    // 返回当前位置指针
+    char *current() { return cur_; }
+    // 重置缓冲区
+    void reset() { cur_ = data_; }
+    // 返回缓冲区剩余大小
+    int avail() const { return static_cast<int>(end_ - cur_); }
+    // 截断为 len 字节
+    void truncate(int len) { cur_ = data_ + len; }
+    // 在末尾保留 len 字节，releaseTail() 之前不能写入
+    void reserveTail(int len)
+    {
+        tail_ += len;
+        end_ -= len;
+    }
+    void releaseTail(int len)
+    {
+        tail_ -= len;
+        end_ += len;
+    }
+
+    // 允许扩展到 limit 字节
+    void setLimit(int limit);
+    // 是否已经换到了扩展后的内存
+    bool overflowed() const { return block_ != nullptr; }
+    // 被截断(丢弃)的字节数
+    int truncated() const { return truncated_; }
+    // 记录被丢弃的 len 字节
+    void discard(int len) { truncated_ += len; }
+    // 释放到达上限时为截断标记预留的空间，之后不再扩展
+    void releaseTruncateReserve();
+
+private:
+    // 空间不足时的路径：扩展，仍然放不下时写入能放下的部分
+    void appendSlow(const char *buf, int len);
+    // 扩展到至少还能写入 len 字节，返回扩展后是否放得下
+    bool grow(int len);
+    // 取得和归还扩展用的内存：优先使用线程缓存的内存块，*size 更新为实际可用的大小
+    static char *acquireBlock(int *size);
+    static void releaseBlock(char *block);
+
+    char *data_;     // 缓冲区
+    char *cur_;      // 指向当前位置指针
+    char *end_;      // 缓冲区末尾指针(不含末尾保留的空间)
+    int size_;       // 缓冲区大小
+    int tail_;       // 末尾保留的字节数
+    int limit_;      // 最多扩展到的大小，0 表示不扩展
+    int truncated_;  // 被截断的字节数
+    char *block_;    // 扩展后使用的内存，为空时使用外部内存
+};
+
 /**
  * 流式化输出日志类
  */
@@ -62,7 +194,23 @@ class LogStream : noncopyable
     using self = LogStream;
 
 public:
-    using Buffer = LogBuffer<kSmallBuffer>;
+    using Buffer = StreamBuffer;
+
+    // 日志记录的格式
+    enum RecordFormat
+    {
+        kText,   // 文本：日志头之后是消息，字段以 " key=value" 追加在消息之后
+        kJson,   // 每条日志一个 JSON 对象(JSON Lines)，日志头也是字段
+        kLogfmt, // 空格分隔的 key=value，日志头也是字段
+    };
+
+    // 使用自己分配的 kSmallBuffer 大小的缓冲区
+    LogStream()
+        : storage_(new char[kSmallBuffer]), buffer_(storage_.get(), kSmallBuffer), format_(kText), message_(-1)
+    {
+    }
+    // 直接写入外部内存，不负责释放
+    LogStream(char *data, int size) : buffer_(data, size), format_(kText), message_(-1) {}
 
     // 重载 << 运算符
     self &operator<<(bool v)
@@ -79,12 +227,37 @@ public:
     self &operator<<(long long);
     self &operator<<(unsigned long long);
     self &operator<<(const void *);
-    self &operator<<(float v)
-    {
-        *this << static_cast<double>(v);
-        return *this;
-    }
+    self &operator<<(float);
     self &operator<<(double);
+
+    // 定点格式的浮点数，保留 precision 位小数
+    struct Fixed
+    {
+        double value;
+        int precision;
+    };
+    // 例如 stream << LogStream::fixed(price, 3)
+    static Fixed fixed(double value, int precision) { return Fixed{value, precision}; }
+    self &operator<<(Fixed);
+
+    // 带格式的整数
+    struct Integer
+    {
+        uint64_t magnitude; // 绝对值
+        bool negative;      // 是否为负数
+        int width;          // 最小宽度
+        char fill;          // 宽度不足时的填充字符
+        bool hex;           // 是否输出为十六进制
+    };
+    // 十六进制，位数不足 width 时补零，例如 stream << LogStream::hex(flags, 8)
+    static Integer hex(uint64_t value, int width = 0) { return Integer{value, false, width, '0', true}; }
+    // 十进制，位数不足 width 时补零，例如 stream << LogStream::zeroPad(id, 6)
+    template <class T>
+    static Integer zeroPad(T value, int width) { return makeInteger(value, width, '0'); }
+    // 十进制，宽度不足 width 时左边补空格(右对齐)
+    template <class T>
+    static Integer width(T value, int min_width) { return makeInteger(value, min_width, ' '); }
+    self &operator<<(Integer);
     self &operator<<(char v)
     {
         // 如果是字符，直接添加到缓冲区中
@@ -103,6 +276,7 @@ public:
             // 如果为空，输出 (null)
             buffer_.append("(null)", 6);
         }
+        return *this;
     }
     self &operator<<(const unsigned char *v) { return operator<<(reinterpret_cast<const char *>(v)); }
     self &operator<<(const std::string &v)
@@ -116,8 +290,45 @@ public:
         return *this;
     }
 
+    /**
+     * 结构化字段：JSON 中为 ,"key":value，logfmt 和文本中为 " key=value"
+     * 第一次添加字段时结束消息部分，之后不要再用 << 写入消息
+     * key 原样输出，应当只包含字母、数字和下划线；字符串的值按格式加引号并转义
+     * 整个字段放不下时丢弃该字段，不会写入半个字段
+     */
+    self &kv(const char *key, bool v);
+    self &kv(const char *key, char v);
+    self &kv(const char *key, int v);
+    self &kv(const char *key, unsigned int v);
+    self &kv(const char *key, long v);
+    self &kv(const char *key, unsigned long v);
+    self &kv(const char *key, long long v);
+    self &kv(const char *key, unsigned long long v);
+    self &kv(const char *key, double v);
+    self &kv(const char *key, const void *v);
+    self &kv(const char *key, const char *v);
+    self &kv(const char *key, const std::string &v);
+
+    /**
+     * Logger 使用：日志头写完之后开始消息部分
+     * 结构化格式中消息是 msg 字段的值，<< 写入的内容在消息结束时统一转义；同时在末尾预留结束记录的空间
+     */
+    void beginMessage();
+    // Logger 使用：结束一条日志，补全结构并换行
+    void endRecord();
+    // 写入一个字符串值：JSON 中总是加引号，logfmt 和文本中需要时才加
+    void appendValue(const char *data, int len);
+    // 允许缓冲区扩展到 limit 字节，超过时截断并在日志末尾注明，见 StreamBuffer
+    void setLimit(int limit) { buffer_.setLimit(limit); }
+    // 设置和返回记录的格式
+    void setFormat(RecordFormat format) { format_ = format; }
+    RecordFormat format() const { return format_; }
+
     // 向缓冲区后面添加
     void append(const char *data, int len) { buffer_.append(data, len); }
+    // 预留 len 字节直接写入，空间不足时返回 nullptr；写入后用 commit() 提交实际长度
+    char *reserve(int len) { return buffer_.ensure(len) ? buffer_.current() : nullptr; }
+    void commit(size_t len) { buffer_.add(len); }
     // 返回缓冲区
     const Buffer &buffer() { return buffer_; }
     // 重置缓冲区
@@ -127,7 +338,32 @@ private:
     // 把整型按照T类型格式化到缓冲区中
     template <class T>
     void formatInteger(T);
+    // 把浮点数按最短且能精确还原的格式写入缓冲区中
+    template <class T>
+    void formatFloating(T);
+
+    // 写入一个数值：convert(p) 把数值写到 p 处并返回长度，最多 kMaxNumericSize 字节
+    template <class Convert>
+    void appendNumeric(Convert convert);
+    // 开始一个字段：写入 key 和分隔符，同时预留 value_size 字节，空间不足时返回 nullptr
+    char *beginField(const char *key, int value_size);
+    // 结束消息部分：转义并加上引号
+    void endMessage();
+    // 字符串值是否需要加引号，以及写入后的长度
+    bool quoteValue(const char *data, int len) const;
+    int valueSize(const char *data, int len) const;
+
+    template <class T>
+    static Integer makeInteger(T value, int width, char fill)
+    {
+        static_assert(std::is_integral<T>::value, "integer required");
+        bool negative = value < 0;
+        uint64_t magnitude = negative ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+        return Integer{magnitude, negative, width, fill, false};
+    }
 
-    Buffer buffer_;                        // 缓冲区
-    static const int kMaxNumericSize = 32; // annotations
+    std::unique_ptr<char[]> storage_; // 自己分配的内存，写入外部内存时为空
+    Buffer buffer_;                   // 缓冲区
+    RecordFormat format_;             // 记录的格式
+    int message_;                     // 结构化格式中尚未结束的消息的起始位置，-1 表示没有
 };
@@ -0,0 +1,175 @@
+#include "mmapwriter.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+MmapFileWriter::MmapFileWriter(const std::string &file_name, off_t reserve_size)
+    : fd_(::open(file_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)),
+      offset_(0),
+      allocated_(0),
+      reserve_step_(std::max(reserve_size, kWindowSize)),
+      window_(nullptr),
+      window_start_(0),
+      flushed_(0),
+      fallback_(false)
+{
+    if (fd_ < 0)
+    {
+        fprintf(stderr, "MmapFileWriter open %s failed %d\n", file_name.c_str(), errno);
+        fallback_ = true;
+        return;
+    }
+    lockInUse(fd_);
+    // 与 stdio 的 "a" 模式一致：接在已有内容之后
+    offset_ = ::lseek(fd_, 0, SEEK_END);
+    allocated_ = offset_;
+    flushed_ = offset_;
+    if (!reserve(offset_ + reserve_step_) || !mapWindow())
+    {
+        fallback_ = true;
+    }
+}
+
+MmapFileWriter::~MmapFileWriter()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    unmapWindow();
+    // 去掉预先分配但没有写入的部分
+    if (::ftruncate(fd_, offset_) != 0)
+    {
+        fprintf(stderr, "MmapFileWriter ftruncate failed %d\n", errno);
+    }
+    ::close(fd_);
+}
+
+bool MmapFileWriter::reserve(off_t end)
+{
+    if (end <= allocated_)
+    {
+        return true;
+    }
+    // 按 reserve_step_ 成块分配，减少 fallocate 次数
+    off_t new_size = allocated_ + reserve_step_;
+    if (new_size < end)
+    {
+        new_size = end;
+    }
+    int err = ::fallocate(fd_, 0, allocated_, new_size - allocated_);
+    if (err != 0 && (errno == EOPNOTSUPP || errno == ENOSYS))
+    {
+        // 文件系统不支持 fallocate 时由 glibc 逐块写零
+        err = ::posix_fallocate(fd_, allocated_, new_size - allocated_);
+        if (err != 0)
+        {
+            errno = err;
+        }
+    }
+    if (err != 0)
+    {
+        // 没有真正分配的空间写 mmap 会收到 SIGBUS，必须退回 pwrite
+        fprintf(stderr, "MmapFileWriter fallocate failed %d, falling back to pwrite\n", errno);
+        return false;
+    }
+    allocated_ = new_size;
+    return true;
+}
+
+bool MmapFileWriter::mapWindow()
+{
+    unmapWindow();
+    off_t page = static_cast<off_t>(::sysconf(_SC_PAGESIZE));
+    window_start_ = offset_ & ~(page - 1);
+    if (!reserve(window_start_ + kWindowSize))
+    {
+        return false;
+    }
+    void *window = ::mmap(nullptr, kWindowSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, window_start_);
+    if (window == MAP_FAILED)
+    {
+        fprintf(stderr, "MmapFileWriter mmap failed %d, falling back to pwrite\n", errno);
+        return false;
+    }
+    window_ = static_cast<char *>(window);
+    return true;
+}
+
+void MmapFileWriter::unmapWindow()
+{
+    if (window_ == nullptr)
+    {
+        return;
+    }
+    // 写过的部分开始写回，然后解除映射，不再占用进程的页表
+    ::msync(window_, kWindowSize, MS_ASYNC);
+    ::madvise(window_, kWindowSize, MADV_DONTNEED);
+    ::munmap(window_, kWindowSize);
+    window_ = nullptr;
+}
+
+bool MmapFileWriter::append(const char *line, const size_t len)
+{
+    written_bytes_ += static_cast<off_t>(len);
+    size_t remain = len;
+    while (remain > 0 && !fallback_)
+    {
+        off_t window_end = window_start_ + kWindowSize;
+        if (offset_ >= window_end && !mapWindow())
+        {
+            fallback_ = true;
+            break;
+        }
+        size_t n = std::min(remain, static_cast<size_t>(window_start_ + kWindowSize - offset_));
+        memcpy(window_ + (offset_ - window_start_), line, n);
+        line += n;
+        remain -= n;
+        offset_ += static_cast<off_t>(n);
+    }
+    // 退回 pwrite：剩下的内容直接写到文件中
+    while (remain > 0)
+    {
+        ssize_t n = fd_ >= 0 ? ::pwrite(fd_, line, remain, offset_) : -1;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "MmapFileWriter::append() failed %d\n", errno);
+            return false;
+        }
+        line += n;
+        remain -= static_cast<size_t>(n);
+        offset_ += n;
+    }
+    return true;
+}
+
+bool MmapFileWriter::flush()
+{
+    if (window_ == nullptr || offset_ <= flushed_)
+    {
+        return true;
+    }
+    // 只写回当前窗口中上次之后写入的部分
+    off_t page = static_cast<off_t>(::sysconf(_SC_PAGESIZE));
+    off_t start = std::max(flushed_, window_start_) & ~(page - 1);
+    flushed_ = offset_;
+    return ::msync(window_ + (start - window_start_), static_cast<size_t>(offset_ - start), MS_ASYNC) == 0;
+}
+
+bool MmapFileWriter::sync()
+{
+    if (window_ != nullptr && ::msync(window_, kWindowSize, MS_SYNC) != 0)
+    {
+        return false;
+    }
+    return fd_ < 0 || ::fdatasync(fd_) == 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "logfile.h"
+
+#include <string>
+#include <sys/types.h>
+
+/**
+ * 通过 mmap 写日志文件
+ * 新文件先用 fallocate 预先分配 reserve_size 字节，写入时只是内存复制，没有系统调用，
+ * 也不会在写路径上分配文件块。只映射写位置附近的一个窗口，窗口写满后向后滑动，
+ * 写过的部分 msync 后用 madvise(MADV_DONTNEED) 解除映射。
+ * 写入的数据立即进入页缓存，进程崩溃时不会丢失。
+ * 关闭文件时截断到实际长度；预先分配失败(例如磁盘已满)时退回 pwrite
+ */
+class MmapFileWriter : public LogWriter
+{
+public:
+    MmapFileWriter(const std::string &file_name, off_t reserve_size);
+    ~MmapFileWriter();
+
+    bool append(const char *line, const size_t len) override;
+    // 数据已经在页缓存中，只是提前开始写回
+    bool flush() override;
+    bool sync() override;
+
+private:
+    static const off_t kWindowSize = 8 * 1024 * 1024; // 映射窗口的大小
+
+    // 确保文件至少分配到 end，失败时返回 false
+    bool reserve(off_t end);
+    // 把窗口移动到包含 offset_ 的位置
+    bool mapWindow();
+    void unmapWindow();
+
+    int fd_;
+    off_t offset_;        // 写位置
+    off_t allocated_;     // 已经预先分配的长度
+    off_t reserve_step_;  // 每次预先分配的长度
+    char *window_;        // 映射窗口，nullptr 表示没有映射
+    off_t window_start_;  // 窗口在文件中的起始位置(页对齐)
+    off_t flushed_;       // 已经开始写回的位置
+    bool fallback_;       // 是否已经退回 pwrite
+};
@@ -0,0 +1,67 @@
+#include "shardedlogging.h"
+
+#include <algorithm>
+#include <string.h>
+#include <string>
+
+ShardedAsyncLogging::ShardedAsyncLogging(int shards, ShardMapping mapping, int flush_interval, int roll_size,
+                                         bool staging, const LogFileOptions &file_options)
+    : mapping_(staging ? ShardMapping::kThreadId : mapping)
+{
+    shards = std::max(shards, 1);
+    shards_.reserve(shards);
+    for (int i = 0; i < shards; ++i)
+    {
+        LogFileOptions options = file_options;
+        options.name = file_options.name.empty() ? "shard" + std::to_string(i)
+                                                 : file_options.name + ".shard" + std::to_string(i);
+        shards_.emplace_back(new AsyncLogging(flush_interval, roll_size, staging, options));
+    }
+}
+
+ShardedAsyncLogging::~ShardedAsyncLogging() = default;
+
+AsyncLoggingMetrics ShardedAsyncLogging::metrics() const
+{
+    AsyncLoggingMetrics total;
+    memset(&total, 0, sizeof(total));
+    for (const auto &shard : shards_)
+    {
+        AsyncLoggingMetrics m = shard->metrics();
+        for (int i = 0; i < kNumLogLevels; ++i)
+        {
+            total.accepted.messages[i] += m.accepted.messages[i];
+            total.accepted.bytes[i] += m.accepted.bytes[i];
+            total.dropped.messages[i] += m.dropped.messages[i];
+            total.dropped.bytes[i] += m.dropped.bytes[i];
+        }
+        total.buffers_swapped += m.buffers_swapped;
+        total.queue_high_water = std::max(total.queue_high_water, m.queue_high_water);
+        total.batches += m.batches;
+        total.append_ns += m.append_ns;
+        total.flush_ns += m.flush_ns;
+        total.file_rolls += m.file_rolls;
+        total.write_errors += m.write_errors;
+        for (int i = 0; i < AsyncLoggingMetrics::kLatencyBuckets; ++i)
+        {
+            total.batch_latency[i] += m.batch_latency[i];
+        }
+    }
+    return total;
+}
+
+void ShardedAsyncLogging::stop()
+{
+    for (auto &shard : shards_)
+    {
+        shard->stop();
+    }
+}
+
+void ShardedAsyncLogging::shutdown()
+{
+    for (auto &shard : shards_)
+    {
+        shard->shutdown();
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "asynclogging.h"
+#include "currentthread.h"
+#include "noncopyable.h"
+
+#include <memory>
+#include <vector>
+#include <sched.h>
+
+// 前端线程映射到分片的方式
+enum class ShardMapping
+{
+    kThreadId, // 按线程id：同一线程始终写同一个分片，线程内的日志顺序不变
+    kCpu,      // 按当前CPU：同一CPU上的线程共享分片，线程迁移后会换分片
+};
+
+/**
+ * 分片的异步日志：N 个 AsyncLogging，每个有自己的日志线程和日志文件
+ * 第 i 个分片的文件名为 <程序名>.shard<i>.<pid>...，用 logmerge 工具按时间戳合并
+ * 暂存队列绑定在线程上，开启 staging 时只能按线程id映射
+ */
+class ShardedAsyncLogging : noncopyable
+{
+public:
+    ShardedAsyncLogging(int shards, ShardMapping mapping = ShardMapping::kThreadId, int flush_interval = 500,
+                        int roll_size = 20 * 1024 * 1024, bool staging = false,
+                        const LogFileOptions &file_options = LogFileOptions());
+    ~ShardedAsyncLogging();
+
+    // 当前线程对应的分片
+    AsyncLogging *shard()
+    {
+        unsigned index;
+        if (mapping_ == ShardMapping::kCpu)
+        {
+            int cpu = ::sched_getcpu();
+            index = cpu < 0 ? 0 : static_cast<unsigned>(cpu);
+        }
+        else
+        {
+            index = static_cast<unsigned>(CurrentThread::tid());
+        }
+        return shards_[index % shards_.size()].get();
+    }
+
+    void append(const char *buf, int len, int level = 2) { shard()->append(buf, len, level); }
+
+    int shardCount() const { return static_cast<int>(shards_.size()); }
+    AsyncLogging &shardAt(int index) { return *shards_[index]; }
+    // 所有分片的运行指标之和(队列最大长度取各分片的最大值)
+    AsyncLoggingMetrics metrics() const;
+
+    void stop();
+    // 停止所有分片的日志线程，可以重复调用
+    void shutdown();
+
+private:
+    const ShardMapping mapping_;
+    std::vector<std::unique_ptr<AsyncLogging>> shards_;
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string.h> // memcpy
+#include <vector>
+
+const int kStagingRingSize = 256 * 1024; // 每个线程暂存环形队列的大小，必须是2的幂
+
+/**
+ * 单生产者单消费者(SPSC)的无锁环形队列
+ * 每个前端线程独占一个，后端日志线程负责读取
+ * 队列中的每条记录由 RecordHeader + 日志内容组成，按16字节对齐，记录不会跨越队列末尾
+ * 队列满时记录写入加锁的溢出区(同样的记录格式)，之后的记录也写入溢出区，直到后端取走它，
+ * 后端先读队列再读溢出区，同一线程的日志保持写入的顺序
+ */
+class StagingRing : noncopyable
+{
+public:
+    // 记录头
+    struct RecordHeader
+    {
+        uint32_t len;   // 日志内容长度
+        uint16_t kind;  // 记录类型
+        uint16_t level; // 日志级别，供后端统计
+        int64_t time;   // 时间戳(微秒)，后端按它恢复多个线程之间的顺序
+    };
+
+    // 记录类型
+    enum Kind
+    {
+        kText,     // 已经格式化好的文本
+        kDeferred, // 延迟格式化的日志：调用点描述信息 + 参数的原始字节，由日志线程格式化
+        kPadding,  // 填充：队列末尾剩余空间不足时跳回队首
+    };
+
+    StagingRing() : head_(0), tail_(0), cached_head_(0), reserved_(false), closed_(false), spilled_(false) {}
+
+    /**
+     * 生产者：写入一条记录
+     * 队列空间不足时返回false，由调用者决定如何处理
+     */
+    bool push(const char *buf, int len, int64_t time, uint32_t kind = kText, int level = 0)
+    {
+        char *dest = reserve(len);
+        if (dest == nullptr)
+        {
+            return false;
+        }
+        memcpy(dest, buf, len);
+        commit(len, time, kind, level);
+        return true;
+    }
+
+    /**
+     * 生产者：预留一段至少 len 字节的连续空间，返回写入位置
+     * 空间不足或者上一次预留还没有发布时返回 nullptr。预留后必须调用 commit() 发布
+     */
+    char *reserve(int len)
+    {
+        uint64_t need = recordSize(len);
+        // 溢出区中有记录时，后面的记录也必须写入溢出区
+        if (reserved_ || len < 0 || need > kStagingRingSize / 2 || spilled_.load(std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t offset = tail & kMask;
+        uint64_t contiguous = kStagingRingSize - offset;
+        // 末尾连续空间不足时需要先填充到队首
+        uint64_t total = contiguous < need ? contiguous + need : need;
+        if (tail + total - cached_head_ > kStagingRingSize)
+        {
+            // 缓存的读位置过旧，重新读取一次
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail + total - cached_head_ > kStagingRingSize)
+            {
+                return nullptr;
+            }
+        }
+        if (contiguous < need)
+        {
+            RecordHeader *padding = header(tail);
+            padding->len = 0;
+            padding->kind = kPadding;
+            padding->level = 0;
+            padding->time = 0;
+            tail += contiguous;
+            // 填充记录只对生产者可见，commit时与新记录一起发布
+        }
+        reserved_tail_ = tail;
+        reserved_ = true;
+        return reinterpret_cast<char *>(header(tail) + 1);
+    }
+
+    // 生产者：发布最近一次 reserve() 得到的记录, len 不能超过预留的长度
+    void commit(int len, int64_t time, uint32_t kind = kText, int level = 0)
+    {
+        RecordHeader *h = header(reserved_tail_);
+        h->len = static_cast<uint32_t>(len);
+        h->kind = static_cast<uint16_t>(kind);
+        h->level = static_cast<uint16_t>(level);
+        h->time = time;
+        reserved_ = false;
+        tail_.store(reserved_tail_ + recordSize(len), std::memory_order_release);
+    }
+
+    // 生产者：放弃最近一次 reserve() 得到的空间，填充记录也不会发布
+    void cancel() { reserved_ = false; }
+
+    /**
+     * 生产者：队列满时写入溢出区，超过 limit 字节时返回 false(溢出区为空时总能写入一条)
+     * 写入后 reserve() 返回 nullptr，直到消费者用 takeSpill() 取走溢出区
+     */
+    bool spill(const char *buf, int len, int64_t time, uint32_t kind, int level, size_t limit)
+    {
+        std::unique_lock<std::mutex> guard(spill_mutex_);
+        size_t used = spill_.size();
+        size_t size = static_cast<size_t>(recordSize(len));
+        if (used > 0 && used + size > limit)
+        {
+            return false;
+        }
+        spill_.resize(used + size);
+        RecordHeader h;
+        h.len = static_cast<uint32_t>(len);
+        h.kind = static_cast<uint16_t>(kind);
+        h.level = static_cast<uint16_t>(level);
+        h.time = time;
+        memcpy(&spill_[used], &h, sizeof(h));
+        memcpy(&spill_[used + sizeof(h)], buf, len);
+        spilled_.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 生产者：已使用的字节数(近似值)
+    uint64_t used() const { return tail_.load(std::memory_order_relaxed) - cached_head_; }
+
+    // 消费者：当前读位置
+    uint64_t head() const { return head_.load(std::memory_order_relaxed); }
+    // 消费者：当前已发布的写位置
+    uint64_t tail() const { return tail_.load(std::memory_order_acquire); }
+    /**
+     * 消费者：取走溢出区到 spill 中，返回同一时刻已发布的写位置
+     * 队列中这个位置之前的记录都早于溢出区中的记录，之后的记录都晚于它们
+     */
+    uint64_t takeSpill(std::vector<char> &spill)
+    {
+        std::unique_lock<std::mutex> guard(spill_mutex_);
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        spill.clear();
+        spill.swap(spill_);
+        spilled_.store(false, std::memory_order_relaxed);
+        return tail;
+    }
+    // 消费者：溢出区中是否还有记录
+    bool spilled() const { return spilled_.load(std::memory_order_relaxed); }
+    // 消费者：读取 pos 处的记录，跳过填充记录。pos 会被调整到真正的记录位置
+    const RecordHeader *record(uint64_t &pos) const
+    {
+        const RecordHeader *h = header(pos);
+        if (h->kind == kPadding)
+        {
+            pos += kStagingRingSize - (pos & kMask);
+            h = header(pos);
+        }
+        return h;
+    }
+    // 消费者：pos 处记录的下一条记录位置(队列和溢出区相同)
+    static uint64_t next(uint64_t pos, const RecordHeader *h) { return pos + recordSize(h->len); }
+    // 消费者：释放 pos 之前的空间
+    void release(uint64_t pos) { head_.store(pos, std::memory_order_release); }
+
+    // 所属线程退出时关闭，后端读完剩余数据后回收
+    void close() { closed_.store(true, std::memory_order_release); }
+    bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+    static const uint64_t kMask = kStagingRingSize - 1;
+
+    static uint64_t recordSize(int len)
+    {
+        return (sizeof(RecordHeader) + static_cast<uint64_t>(len) + 15) & ~static_cast<uint64_t>(15);
+    }
+    RecordHeader *header(uint64_t pos) { return reinterpret_cast<RecordHeader *>(data_ + (pos & kMask)); }
+    const RecordHeader *header(uint64_t pos) const
+    {
+        return reinterpret_cast<const RecordHeader *>(data_ + (pos & kMask));
+    }
+
+    alignas(64) std::atomic<uint64_t> head_; // 读位置：只由消费者修改
+    alignas(64) std::atomic<uint64_t> tail_; // 写位置：只由生产者修改
+    uint64_t cached_head_;                   // 生产者缓存的读位置，减少对 head_ 的访问
+    uint64_t reserved_tail_;                 // 最近一次 reserve() 的位置
+    bool reserved_;                          // 是否有尚未发布的预留空间(同一线程嵌套输出日志时)
+    std::atomic<bool> closed_;               // 所属线程是否已经退出
+    std::mutex spill_mutex_;                 // 保护溢出区
+    std::vector<char> spill_;                // 溢出区：队列满时的记录
+    std::atomic<bool> spilled_;              // 溢出区是否有记录：只由生产者置位，由消费者清除
+    alignas(64) char data_[kStagingRingSize];
+};
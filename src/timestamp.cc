@@ -1,5 +1,6 @@
 #include "timestamp.h"
 #include <sys/time.h>
+#include <time.h>
 
 /**
  * struct timeval{
@@ -18,3 +19,17 @@ int64_t Timestamp::now()
     // 返回Epoch(1970-1-1)到当前时间经过了多少微秒
     return tv.tv_sec * kMicroSecondsPerSecond + tv.tv_usec;
 }
+
+int64_t Timestamp::monotonicNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+int64_t Timestamp::coarseMonotonicNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
@@ -7,5 +7,9 @@ using namespace std;
 class Timestamp{
 public:
     static int64_t now();
+    // 单调时钟(纳秒)，用于测量耗时
+    static int64_t monotonicNanos();
+    // 粗粒度的单调时钟(纳秒)：精度为一个时钟节拍(通常 1~4 毫秒)，但读取开销只有几纳秒
+    static int64_t coarseMonotonicNanos();
     static const int kMicroSecondsPerSecond = 1000 * 1000;    
 };
\ No newline at end of file
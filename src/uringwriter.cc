@@ -0,0 +1,297 @@
+#include "uringwriter.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+namespace
+{
+int uringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+// 与内核共享的队列指针
+unsigned loadAcquire(const unsigned *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+void storeRelease(unsigned *p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+} // namespace
+
+UringFileWriter::UringFileWriter(const std::string &file_name, unsigned queue_depth)
+    : fd_(::open(file_name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644)),
+      offset_(0),
+      ring_fd_(-1),
+      ring_failed_(false),
+      in_flight_(0),
+      failed_(0),
+      sq_ptr_(MAP_FAILED),
+      sq_size_(0),
+      sqes_(nullptr),
+      sqes_size_(0),
+      cq_ptr_(MAP_FAILED),
+      cq_size_(0)
+{
+    if (fd_ < 0)
+    {
+        fprintf(stderr, "UringFileWriter open %s failed %d\n", file_name.c_str(), errno);
+        return;
+    }
+    lockInUse(fd_);
+    // 与 stdio 的 "a" 模式一致：接在已有内容之后
+    offset_ = ::lseek(fd_, 0, SEEK_END);
+    written_bytes_ = 0;
+    if (!setupRing(queue_depth))
+    {
+        fprintf(stderr, "UringFileWriter: io_uring unavailable, falling back to pwritev\n");
+    }
+}
+
+UringFileWriter::~UringFileWriter()
+{
+    // 等待所有写入完成，之后调用者的缓冲区才可以回收
+    if (ring_fd_ >= 0)
+    {
+        reap(in_flight_);
+        if (sqes_)
+        {
+            ::munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+        {
+            ::munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_ != MAP_FAILED)
+        {
+            ::munmap(sq_ptr_, sq_size_);
+        }
+        ::close(ring_fd_);
+    }
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+}
+
+bool UringFileWriter::setupRing(unsigned queue_depth)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = uringSetup(queue_depth, &params);
+    if (ring_fd < 0)
+    {
+        return false;
+    }
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // 新内核可以用一次 mmap 同时映射提交队列和完成队列
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sq_ptr_ = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED)
+    {
+        ::close(ring_fd);
+        return false;
+    }
+    cq_ptr_ = single_mmap ? sq_ptr_
+                          : ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                                   IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                        IORING_OFF_SQES);
+    if (cq_ptr_ == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+        {
+            ::munmap(cq_ptr_, cq_size_);
+        }
+        ::munmap(sq_ptr_, sq_size_);
+        sq_ptr_ = cq_ptr_ = MAP_FAILED;
+        ::close(ring_fd);
+        return false;
+    }
+    sqes_ = static_cast<struct io_uring_sqe *>(sqes);
+
+    char *sq = static_cast<char *>(sq_ptr_);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    char *cq = static_cast<char *>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    requests_.assign(params.sq_entries, Request{nullptr, {nullptr, 0}, 0, false});
+    ring_fd_ = ring_fd;
+    return true;
+}
+
+bool UringFileWriter::writeAll(const char *data, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        struct iovec iov = {const_cast<char *>(data), len};
+        ssize_t n = ::pwritev(fd_, &iov, 1, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "UringFileWriter::writeAll() failed %d\n", errno);
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+bool UringFileWriter::append(const char *line, const size_t len)
+{
+    off_t offset = offset_;
+    offset_ += static_cast<off_t>(len);
+    written_bytes_ += static_cast<off_t>(len);
+    return fd_ >= 0 && writeAll(line, len, offset);
+}
+
+bool UringFileWriter::submit(const char *data, size_t len, void *tag)
+{
+    if (ring_fd_ < 0 || ring_failed_)
+    {
+        // 退回同步写入，立即完成
+        bool ok = append(data, len);
+        completed_.push_back(tag);
+        return ok;
+    }
+
+    // 队列已满时等待一个写入完成
+    if (in_flight_ == requests_.size())
+    {
+        reap(1);
+    }
+    unsigned index = 0;
+    while (requests_[index].busy)
+    {
+        ++index;
+    }
+    Request &request = requests_[index];
+    request.tag = tag;
+    request.iov.iov_base = const_cast<char *>(data);
+    request.iov.iov_len = len;
+    request.offset = offset_;
+    request.busy = true;
+    offset_ += static_cast<off_t>(len);
+    written_bytes_ += static_cast<off_t>(len);
+
+    // 填写提交队列项：只有日志线程提交，尾指针不需要原子读
+    unsigned tail = *sq_tail_;
+    unsigned slot = tail & *sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&request.iov);
+    sqe->len = 1;
+    sqe->off = static_cast<uint64_t>(request.offset);
+    sqe->user_data = index;
+    sq_array_[slot] = slot;
+    storeRelease(sq_tail_, tail + 1);
+    ++in_flight_;
+
+    int ret;
+    do
+    {
+        ret = uringEnter(ring_fd_, 1, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+    {
+        // 提交失败：撤回这一项，改为同步写入
+        storeRelease(sq_tail_, tail);
+        --in_flight_;
+        request.busy = false;
+        completed_.push_back(tag);
+        return writeAll(data, len, request.offset);
+    }
+    return true;
+}
+
+void UringFileWriter::reap(unsigned wait_count)
+{
+    unsigned reaped = 0;
+    for (;;)
+    {
+        unsigned head = *cq_head_;
+        unsigned tail = loadAcquire(cq_tail_);
+        while (head != tail)
+        {
+            const struct io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+            Request &request = requests_[cqe.user_data];
+            size_t len = request.iov.iov_len;
+            if (cqe.res < 0 || static_cast<size_t>(cqe.res) < len)
+            {
+                // 出错或者只写了一部分：剩下的同步写完
+                size_t done = cqe.res < 0 ? 0 : static_cast<size_t>(cqe.res);
+                if (cqe.res < 0 && cqe.res != -EAGAIN && cqe.res != -EINTR)
+                {
+                    fprintf(stderr, "UringFileWriter write failed %d\n", -cqe.res);
+                }
+                if (!writeAll(static_cast<const char *>(request.iov.iov_base) + done, len - done,
+                              request.offset + static_cast<off_t>(done)))
+                {
+                    ++failed_;
+                }
+            }
+            completed_.push_back(request.tag);
+            request.busy = false;
+            --in_flight_;
+            ++reaped;
+            ++head;
+        }
+        storeRelease(cq_head_, head);
+        if (reaped >= wait_count || in_flight_ == 0)
+        {
+            return;
+        }
+        int ret = uringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            // 不能再等待完成事件，但已经提交的写入仍然由内核完成并写入完成队列：
+            // 轮询完成队列直到等够，不能在写完之前把缓冲区还给调用者；之后的写入改为同步 pwritev
+            if (!ring_failed_)
+            {
+                fprintf(stderr, "UringFileWriter io_uring_enter failed %d, falling back to pwritev\n", errno);
+                ring_failed_ = true;
+            }
+            ::usleep(1000);
+        }
+    }
+}
+
+int UringFileWriter::takeCompleted(std::vector<void *> &tags, bool wait)
+{
+    if (ring_fd_ >= 0)
+    {
+        reap(wait ? in_flight_ : 0);
+    }
+    tags.insert(tags.end(), completed_.begin(), completed_.end());
+    completed_.clear();
+    int failed = failed_;
+    failed_ = 0;
+    return failed;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "logfile.h"
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+ * 用 io_uring 写日志文件
+ * 大缓冲区直接提交给内核，最多同时有 queue_depth 个写入在进行，日志线程不会阻塞在每次写入上。
+ * 每次写入使用提交时确定的文件偏移，完成的先后顺序不影响文件内容。
+ * io_uring 不可用时(内核太旧、被 seccomp 禁止)退回同步的 pwritev
+ */
+class UringFileWriter : public LogWriter
+{
+public:
+    explicit UringFileWriter(const std::string &file_name, unsigned queue_depth = 8);
+    ~UringFileWriter();
+
+    // 同步写入：直接 pwrite 到当前偏移
+    bool append(const char *line, const size_t len) override;
+    // 数据已经在提交时交给内核，不需要刷新
+    bool flush() override { return true; }
+    // 调用之前所有写入必须已经完成
+    bool sync() override { return fd_ < 0 || ::fdatasync(fd_) == 0; }
+
+    bool submit(const char *data, size_t len, void *tag) override;
+    int takeCompleted(std::vector<void *> &tags, bool wait) override;
+
+    // 是否真正使用了 io_uring
+    bool usingUring() const { return ring_fd_ >= 0 && !ring_failed_; }
+
+private:
+    // 一个正在进行的写入
+    struct Request
+    {
+        void *tag;
+        struct iovec iov;
+        off_t offset;
+        bool busy;
+    };
+
+    bool setupRing(unsigned queue_depth);
+    // 从完成队列中取出完成的写入，wait_count 为至少要等待的个数
+    // io_uring_enter 出错时轮询完成队列，等够之前不会返回
+    void reap(unsigned wait_count);
+    // 同步写完 [data, data + len)
+    bool writeAll(const char *data, size_t len, off_t offset);
+
+    int fd_;
+    off_t offset_;                 // 下一次写入的文件偏移
+    int ring_fd_;                  // io_uring 实例，-1 表示不可用
+    bool ring_failed_;             // io_uring_enter 出错过：新的写入改为同步，只收取已经提交的写入
+    unsigned in_flight_;           // 正在进行的写入个数
+    int failed_;                   // 写入失败的个数，takeCompleted() 时清零
+    std::vector<Request> requests_; // 按 user_data 索引
+    std::vector<void *> completed_; // 已经写完的 tag
+
+    // 提交队列
+    void *sq_ptr_;
+    size_t sq_size_;
+    unsigned *sq_tail_;
+    unsigned *sq_mask_;
+    unsigned *sq_array_;
+    struct io_uring_sqe *sqes_;
+    size_t sqes_size_;
+    // 完成队列
+    void *cq_ptr_;
+    size_t cq_size_;
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    unsigned *cq_mask_;
+    struct io_uring_cqe *cqes_;
+};
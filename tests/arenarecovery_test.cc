@@ -0,0 +1,102 @@
+// 崩溃恢复：进程被杀死后缓冲区中还没有写入日志文件的内容，下次启动时保存到崩溃文件并写入日志
+#include "testutil.h"
+#include "asynclogging.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace
+{
+const int kMessages = 100;
+
+LogFileOptions crashSafeOptions()
+{
+    LogFileOptions options;
+    options.crash_safe = true;
+    return options;
+}
+
+// 子进程：写入一些日志后被 SIGKILL 杀死，日志只在缓冲区(文件映射)中
+void logAndDie()
+{
+    // 刷新间隔很长：被杀死之前日志线程不会写出缓冲区
+    AsyncLogging async(600 * 1000, 1 << 30, false, crashSafeOptions());
+    Logger::setOutputFunc([&async](const LogStream::Buffer &buf) { async.append(buf.data(), buf.length()); });
+    for (int i = 0; i < kMessages; ++i)
+    {
+        LOG_INFO << "pending " << i;
+    }
+    ::kill(::getpid(), SIGKILL);
+}
+
+int countContaining(const std::string &data, const char *text)
+{
+    int count = 0;
+    for (size_t pos = data.find(text); pos != std::string::npos; pos = data.find(text, pos + 1))
+    {
+        ++count;
+    }
+    return count;
+}
+
+void testRoundTrip()
+{
+    clearLogDir();
+    pid_t child = ::fork();
+    if (child == 0)
+    {
+        logAndDie();
+        _exit(1);
+    }
+    int status = 0;
+    ::waitpid(child, &status, 0);
+    CHECK(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+
+    std::string dir;
+    std::string prefix;
+    CHECK(LogFile::basePath(crashSafeOptions(), &dir, &prefix));
+    const std::string buf_path = dir + prefix + ".buf";
+
+    // logrecover 的读取方式：只读，不清零
+    std::string data;
+    pid_t pid = 0;
+    CHECK(BufferArena::recoverFile(buf_path, &data, &pid, false));
+    CHECK_EQ(pid, child);
+    CHECK_EQ(countContaining(data, " pending "), kMessages);
+    CHECK_CONTAINS(data, " pending 0\n");
+    CHECK_CONTAINS(data, " pending 99\n");
+
+    // 下次启动：恢复的数据先保存到崩溃文件，再写入新的日志
+    {
+        AsyncLogging async(100, 1 << 30, false, crashSafeOptions());
+        async.stop();
+    }
+    std::string crash = readFile(dir + prefix + "." + std::to_string(child) + ".crash.log");
+    CHECK(crash == data);
+
+    std::string logged;
+    for (const auto &file : listLogFiles())
+    {
+        if (file.find(".crash.log") == std::string::npos)
+        {
+            logged += readFile(file);
+        }
+    }
+    CHECK_CONTAINS(logged, "AsyncLogging recovered ");
+    CHECK_EQ(countContaining(logged, " pending "), kMessages);
+
+    // 已经恢复的数据不会再次恢复
+    data.clear();
+    CHECK(BufferArena::recoverFile(buf_path, &data, &pid, false));
+    CHECK(data.empty());
+}
+} // namespace
+
+int main()
+{
+    testRoundTrip();
+    return testResult();
+}
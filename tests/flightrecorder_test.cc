@@ -0,0 +1,76 @@
+// 飞行记录器：低于当前级别的日志只保存在线程的环形缓冲区中，ERROR 输出时先输出这些上下文
+#include "testutil.h"
+#include "asynclogging.h"
+
+#include <string>
+
+namespace
+{
+// 同步日志：上下文按原来的顺序在错误之前输出，输出后清空
+void testSync(CapturedLog &log)
+{
+    log.clear();
+    for (int i = 0; i < 3; ++i)
+    {
+        LOG_DEBUG << "context " << i;
+    }
+    CHECK(log.lines().empty());
+    LOG_ERROR << "failed";
+    LOG_ERROR << "failed again";
+
+    CHECK_EQ(log.lines().size(), 5);
+    if (log.lines().size() == 5)
+    {
+        CHECK_CONTAINS(log.lines()[0], " context 0\n");
+        CHECK_CONTAINS(log.lines()[2], " context 2\n");
+        CHECK_CONTAINS(log.lines()[3], " failed\n");
+        CHECK_CONTAINS(log.lines()[4], " failed again\n");
+    }
+}
+
+// 异步日志：上下文在错误之前写入文件(开启暂存队列时错误本身直接写入暂存队列)
+void testAsync(bool staging)
+{
+    clearLogDir();
+    {
+        AsyncLogging async(100, 1 << 30, staging);
+        Logger::setOutputFunc(
+            [&async](const LogStream::Buffer &buf) { async.append(buf.data(), buf.length()); });
+        Logger::setAsync(&async);
+        for (int i = 0; i < 3; ++i)
+        {
+            LOG_DEBUG << "context " << i;
+        }
+        LOG_ERROR << "failed";
+        async.stop();
+        Logger::setAsync(nullptr);
+    }
+
+    std::vector<std::string> lines;
+    for (const auto &file : listLogFiles())
+    {
+        for (const auto &line : splitLines(readFile(file)))
+        {
+            lines.push_back(line);
+        }
+    }
+    const char *expected[] = {" context 0", " context 1", " context 2", " failed"};
+    CHECK_EQ(lines.size(), 4);
+    for (size_t i = 0; i < lines.size() && i < 4; ++i)
+    {
+        CHECK_CONTAINS(lines[i], expected[i]);
+    }
+}
+} // namespace
+
+int main()
+{
+    Logger::setFlightRecorder(Logger::DEBUG, 64 * 1024, false);
+    {
+        CapturedLog log;
+        testSync(log);
+    }
+    testAsync(false);
+    testAsync(true);
+    return testResult();
+}
@@ -0,0 +1,127 @@
+// 合并顺序：暂存队列写满(退到溢出区)时同一线程的日志保持顺序；logmerge 按时间戳合并不同格式的文件
+#include "testutil.h"
+
+#include <stdlib.h>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+const int kThreads = 4;
+const int kMessages = 100000;
+
+// 多个线程快速写入，暂存队列会写满；检查每个线程的序号连续递增
+void testStagingOrder()
+{
+    clearLogDir();
+    {
+        // 刷新间隔很长：日志线程只在暂存队列过半或者溢出时才被唤醒
+        AsyncLogging async(3000, 1 << 30, true);
+        Logger::setOutputFunc(
+            [&async](const LogStream::Buffer &buf) { async.append(buf.data(), buf.length()); });
+        Logger::setAsync(&async);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t)
+        {
+            threads.emplace_back([t] {
+                for (int i = 0; i < kMessages; ++i)
+                {
+                    LOG_INFO << "T" << t << " seq " << i;
+                }
+            });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        async.stop();
+        Logger::setAsync(nullptr);
+        CHECK_EQ(async.droppedCounts().messages[Logger::INFO], 0);
+    }
+
+    std::map<int, int> next; // 每个线程下一个期望的序号
+    for (const auto &file : listLogFiles())
+    {
+        for (const auto &line : splitLines(readFile(file)))
+        {
+            size_t pos = line.find(" T");
+            int thread = 0;
+            int seq = 0;
+            if (pos == std::string::npos || sscanf(line.c_str() + pos, " T%d seq %d", &thread, &seq) != 2)
+            {
+                continue;
+            }
+            if (seq != next[thread])
+            {
+                fprintf(stderr, "thread %d: expected seq %d, got %d\n", thread, next[thread], seq);
+                ++testFailures();
+                return;
+            }
+            next[thread] = seq + 1;
+        }
+    }
+    CHECK_EQ(next.size(), kThreads);
+    for (const auto &entry : next)
+    {
+        CHECK_EQ(entry.second, kMessages);
+    }
+}
+
+// 日志线程停止之后写入的日志计入丢弃(不开启暂存队列时当前缓冲区已经被取走)
+void testAppendAfterStop(bool staging)
+{
+    AsyncLogging async(3000, 1 << 30, staging);
+    async.shutdown();
+    const char line[] = "after stop\n";
+    async.append(line, sizeof(line) - 1, Logger::WARN);
+    CHECK_EQ(async.droppedCounts().messages[Logger::WARN], 1);
+    CHECK_EQ(async.droppedCounts().bytes[Logger::WARN], sizeof(line) - 1);
+}
+
+void writeFile(const char *path, const char *data)
+{
+    FILE *file = ::fopen(path, "w");
+    ::fputs(data, file);
+    ::fclose(file);
+}
+
+// 文本(含多行消息)、JSON 和 logfmt 文件一起合并
+void testLogmerge(const char *logmerge)
+{
+    writeFile("a.log",
+              "2024-01-01 00:00:01.000 1 INFO  a.cc:1->f a1\n"
+              "2024-01-01 00:00:03.000 1 INFO  a.cc:2->f a3 first line\n"
+              "continued line\n"
+              "2024-01-01 00:00:05.000 1 INFO  a.cc:3->f a5\n");
+    writeFile("b.log",
+              "{\"time\":\"2024-01-01 00:00:02.000\",\"msg\":\"b2\"}\n"
+              "{\"time\":\"2024-01-01 00:00:05.000\",\"msg\":\"b5\"}\n");
+    writeFile("c.log", "time=\"2024-01-01 00:00:04.000\" msg=c4\n");
+    std::string command = std::string(logmerge) + " -o merged.log a.log b.log c.log";
+    CHECK_EQ(::system(command.c_str()), 0);
+
+    std::vector<std::string> lines = splitLines(readFile("merged.log"));
+    const char *expected[] = {"a1", "b2", "a3 first line", "continued line", "c4", "a5", "b5"};
+    CHECK_EQ(lines.size(), sizeof(expected) / sizeof(expected[0]));
+    for (size_t i = 0; i < lines.size() && i < sizeof(expected) / sizeof(expected[0]); ++i)
+    {
+        CHECK_CONTAINS(lines[i], expected[i]);
+    }
+}
+} // namespace
+
+int main()
+{
+    testStagingOrder();
+    testAppendAfterStop(false);
+    testAppendAfterStop(true);
+    // logmerge 的路径由 CTest 通过环境变量传入(没有编译工具时跳过)
+    if (const char *logmerge = ::getenv("DDLOG_LOGMERGE"))
+    {
+        testLogmerge(logmerge);
+    }
+    return testResult();
+}
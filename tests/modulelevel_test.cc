@@ -0,0 +1,159 @@
+// 模块级别：按源文件和标签单独设置的级别，取消后重新跟随当前日志级别；延迟日志也按模块级别判断，低于级别时写入飞行记录器
+#include "testutil.h"
+#include "asynclogging.h"
+#include "deferredlog.h"
+
+#include <string>
+
+namespace
+{
+// 本文件的模块名：不带目录的源文件名
+const char kFile[] = "modulelevel_test.cc";
+
+void testFileLevel(CapturedLog &log)
+{
+    log.clear();
+    LOG_DEBUG << "debug default";
+    Logger::setModuleLevel(kFile, Logger::DEBUG);
+    LOG_DEBUG << "debug enabled";
+    Logger::setModuleLevel(kFile, Logger::WARN);
+    LOG_INFO << "info disabled";
+    LOG_WARN << "warn enabled";
+    Logger::resetModuleLevel(kFile);
+    LOG_DEBUG << "debug reset";
+    LOG_INFO << "info reset";
+
+    CHECK_EQ(log.lines().size(), 3);
+    if (log.lines().size() == 3)
+    {
+        CHECK_CONTAINS(log.lines()[0], " debug enabled\n");
+        CHECK_CONTAINS(log.lines()[1], " warn enabled\n");
+        CHECK_CONTAINS(log.lines()[2], " info reset\n");
+    }
+}
+
+// 单独设置过级别的模块不随当前日志级别改变，取消后重新跟随
+void testFollowGlobal(CapturedLog &log)
+{
+    log.clear();
+    Logger::setModuleLevel(kFile, Logger::INFO);
+    Logger::setLogLevel(Logger::DEBUG);
+    LOG_DEBUG << "pinned";
+    Logger::resetModuleLevel(kFile);
+    LOG_DEBUG << "following";
+    Logger::setLogLevel(Logger::INFO);
+    LOG_DEBUG << "following info";
+
+    CHECK_EQ(log.lines().size(), 1);
+    CHECK_CONTAINS(log.last(), " following\n");
+}
+
+// 标签和源文件的级别互不影响，WARN 及以上的标签日志总是输出
+void testTagLevel(CapturedLog &log)
+{
+    log.clear();
+    Logger::setModuleLevel(kFile, Logger::DEBUG);
+    LOG_TAG(DEBUG, "net") << "net default";
+    Logger::setModuleLevel("net", Logger::DEBUG);
+    LOG_TAG(DEBUG, "net") << "net debug";
+    LOG_TAG(DEBUG, "disk") << "disk default";
+    Logger::resetModuleLevel(kFile);
+    LOG_TAG(DEBUG, "net") << "net still debug";
+    Logger::setModuleLevel("net", Logger::ERROR);
+    LOG_TAG(WARN, "net") << "net warn";
+    Logger::resetModuleLevel("net");
+
+    CHECK_EQ(log.lines().size(), 3);
+    if (log.lines().size() == 3)
+    {
+        CHECK_CONTAINS(log.lines()[0], " net debug\n");
+        CHECK_CONTAINS(log.lines()[1], " net still debug\n");
+        CHECK_CONTAINS(log.lines()[2], " net warn\n");
+    }
+}
+
+// 同步日志：延迟日志立即格式化输出，级别的判断与 LOG_DEBUG 等宏相同，WARN 及以上总是输出
+void testDeferSync(CapturedLog &log)
+{
+    log.clear();
+    LOG_DEBUG_DEFER("defer default {}", 1);
+    Logger::setModuleLevel(kFile, Logger::DEBUG);
+    LOG_DEBUG_DEFER("defer debug {} {}", 2, "x");
+    Logger::setModuleLevel(kFile, Logger::ERROR);
+    LOG_INFO_DEFER("defer info {}", 3);
+    LOG_WARN_DEFER("defer warn {}", 4);
+    Logger::resetModuleLevel(kFile);
+
+    CHECK_EQ(log.lines().size(), 2);
+    if (log.lines().size() == 2)
+    {
+        CHECK_CONTAINS(log.lines()[0], " defer debug 2 x\n");
+        CHECK_CONTAINS(log.lines()[1], " defer warn 4\n");
+    }
+}
+
+// 低于源文件级别的延迟日志和 LOG_DEBUG 一样写入飞行记录器，ERROR 输出时作为上下文
+void testDeferRecorded(CapturedLog &log)
+{
+    log.clear();
+    Logger::setFlightRecorder(Logger::DEBUG, 64 * 1024, false);
+    LOG_DEBUG_DEFER("defer recorded {}", 5);
+    CHECK(log.lines().empty());
+    LOG_ERROR << "defer error";
+    Logger::setFlightRecorder(Logger::NUM_LOG_LEVELS);
+
+    CHECK_EQ(log.lines().size(), 2);
+    if (log.lines().size() == 2)
+    {
+        CHECK_CONTAINS(log.lines()[0], " defer recorded 5\n");
+        CHECK_CONTAINS(log.lines()[1], " defer error\n");
+    }
+}
+
+// 开启暂存队列的异步日志：低于级别的延迟日志不写入文件，延迟的 ERROR 同样先输出飞行记录器中的上下文
+void testDeferRecordedAsync()
+{
+    clearLogDir();
+    Logger::setFlightRecorder(Logger::DEBUG, 64 * 1024, false);
+    {
+        AsyncLogging async(100, 1 << 30, true);
+        Logger::setOutputFunc(
+            [&async](const LogStream::Buffer &buf) { async.append(buf.data(), buf.length()); });
+        Logger::setAsync(&async);
+        LOG_DEBUG_DEFER("async recorded {}", 6);
+        LOG_INFO_DEFER("async info {}", 7);
+        LOG_ERROR_DEFER("async error {}", 8);
+        async.stop();
+        Logger::setAsync(nullptr);
+    }
+    Logger::setFlightRecorder(Logger::NUM_LOG_LEVELS);
+
+    std::vector<std::string> lines;
+    for (const auto &file : listLogFiles())
+    {
+        for (const auto &line : splitLines(readFile(file)))
+        {
+            lines.push_back(line);
+        }
+    }
+    CHECK_EQ(lines.size(), 3);
+    if (lines.size() == 3)
+    {
+        CHECK_CONTAINS(lines[0], " async info 7");
+        CHECK_CONTAINS(lines[1], " async recorded 6");
+        CHECK_CONTAINS(lines[2], " async error 8");
+    }
+}
+} // namespace
+
+int main()
+{
+    CapturedLog log;
+    testFileLevel(log);
+    testFollowGlobal(log);
+    testTagLevel(log);
+    testDeferSync(log);
+    testDeferRecorded(log);
+    testDeferRecordedAsync();
+    return testResult();
+}
@@ -0,0 +1,118 @@
+// 限流宏：LOG_EVERY_N / LOG_FIRST_N 输出的次数和被跳过的次数
+#include "testutil.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+int countContaining(const std::vector<std::string> &lines, const char *text)
+{
+    int count = 0;
+    for (const auto &line : lines)
+    {
+        if (line.find(text) != std::string::npos)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void testEveryN(CapturedLog &log)
+{
+    log.clear();
+    for (int i = 0; i < 7; ++i)
+    {
+        LOG_EVERY_N(INFO, 3) << "every " << i;
+    }
+    // 第 1、4、7 次输出，之后的两条注明被跳过的次数
+    CHECK_EQ(log.lines().size(), 3);
+    if (log.lines().size() == 3)
+    {
+        CHECK_CONTAINS(log.lines()[0], "->testEveryN every 0\n");
+        CHECK_CONTAINS(log.lines()[1], "(suppressed 2) every 3\n");
+        CHECK_CONTAINS(log.lines()[2], "(suppressed 2) every 6\n");
+    }
+}
+
+void testFirstN(CapturedLog &log)
+{
+    log.clear();
+    for (int i = 0; i < 5; ++i)
+    {
+        LOG_FIRST_N(INFO, 2) << "first " << i;
+    }
+    CHECK_EQ(log.lines().size(), 2);
+    CHECK_EQ(countContaining(log.lines(), "first 0"), 1);
+    CHECK_EQ(countContaining(log.lines(), "first 1"), 1);
+}
+
+// 先判断级别：关闭的级别不消耗计数
+void testLevelCheckedFirst(CapturedLog &log)
+{
+    log.clear();
+    for (int round = 0; round < 2; ++round)
+    {
+        Logger::setLogLevel(round == 0 ? Logger::INFO : Logger::DEBUG);
+        for (int i = 0; i < 3; ++i)
+        {
+            LOG_FIRST_N(DEBUG, 1) << "debug round " << round;
+        }
+    }
+    Logger::setLogLevel(Logger::INFO);
+    CHECK_EQ(log.lines().size(), 1);
+    CHECK_EQ(countContaining(log.lines(), "debug round 1"), 1);
+}
+
+// 多个线程共享调用点的计数
+void testConcurrentCounts()
+{
+    const int kThreads = 4;
+    const int kCalls = 1000;
+    std::atomic<int> every_n(0);
+    std::atomic<int> first_n(0);
+    Logger::setOutputFunc([&](const LogStream::Buffer &buf) {
+        std::string line(buf.data(), buf.length());
+        if (line.find("concurrent every") != std::string::npos)
+        {
+            ++every_n;
+        }
+        else if (line.find("concurrent first") != std::string::npos)
+        {
+            ++first_n;
+        }
+    });
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([] {
+            for (int i = 0; i < kCalls; ++i)
+            {
+                LOG_EVERY_N(INFO, 10) << "concurrent every";
+                LOG_FIRST_N(INFO, 5) << "concurrent first";
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    CHECK_EQ(every_n.load(), kThreads * kCalls / 10);
+    CHECK_EQ(first_n.load(), 5);
+}
+} // namespace
+
+int main()
+{
+    {
+        CapturedLog log;
+        testEveryN(log);
+        testFirstN(log);
+        testLevelCheckedFirst(log);
+    }
+    testConcurrentCounts();
+    return testResult();
+}
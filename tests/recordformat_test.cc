@@ -0,0 +1,93 @@
+// JSON 和 logfmt 格式：消息和字段的转义，异步日志自己输出的记录也使用所选的格式
+#include "testutil.h"
+#include "deferredlog.h"
+
+#include <string>
+
+namespace
+{
+void testJsonEscaping(CapturedLog &log)
+{
+    Logger::setRecordFormat(LogStream::kJson);
+    LOG_INFO << "quote\" back\\ nl\n tab\t ctl\x01 utf8 \xe4\xb8\xad";
+    const std::string &line = log.last();
+    CHECK(line.compare(0, 9, "{\"time\":\"") == 0);
+    CHECK_CONTAINS(line, "\"msg\":\"quote\\\" back\\\\ nl\\n tab\\t ctl\\u0001 utf8 \xe4\xb8\xad\"}\n");
+    // 一条记录只占一行
+    CHECK_EQ(std::count(line.begin(), line.end(), '\n'), 1);
+
+    LOG_KV(INFO, "kv").kv("s", "a \"b\"").kv("n", 42).kv("d", 1.5).kv("b", true);
+    CHECK_CONTAINS(log.last(), "\"msg\":\"kv\",\"s\":\"a \\\"b\\\"\",\"n\":42,\"d\":1.5,\"b\":true}\n");
+}
+
+void testLogfmtEscaping(CapturedLog &log)
+{
+    Logger::setRecordFormat(LogStream::kLogfmt);
+    LOG_INFO << "quote\" back\\ nl\n tab\t";
+    const std::string &line = log.last();
+    CHECK(line.compare(0, 6, "time=\"") == 0);
+    CHECK_CONTAINS(line, " msg=\"quote\\\" back\\\\ nl\\n tab\\t\"\n");
+    CHECK_EQ(std::count(line.begin(), line.end(), '\n'), 1);
+
+    // 消息总是加引号；字段的值含有空格、引号或 = 时加引号，其余不加
+    LOG_KV(INFO, "plain").kv("s", "has space").kv("e", "a=b").kv("plain", "abc").kv("empty", "");
+    CHECK_CONTAINS(log.last(), " msg=\"plain\" s=\"has space\" e=\"a=b\" plain=abc empty=\"\"\n");
+}
+
+// 异步日志：丢弃标记和延迟日志都是合法的 JSON 记录
+void testAsyncJson()
+{
+    clearLogDir();
+    Logger::setRecordFormat(LogStream::kJson);
+    {
+        AsyncLogging async(100, 1 << 30, true);
+        // 队列上限很小：暂存队列写满之后开始丢弃
+        async.setOverflowPolicy(OverflowPolicy::kDropNewest, 1);
+        Logger::setOutputFunc(
+            [&async](const LogStream::Buffer &buf) { async.append(buf.data(), buf.length()); });
+        Logger::setAsync(&async);
+        LOG_INFO_DEFER("deferred {} \"{}\"", 7, "q");
+        std::string padding(200, 'x');
+        for (int i = 0; i < 100000; ++i)
+        {
+            LOG_INFO << "fill " << i << ' ' << padding;
+        }
+        async.stop();
+        Logger::setAsync(nullptr);
+        CHECK(async.droppedCounts().messages[Logger::INFO] > 0);
+    }
+
+    bool found_marker = false;
+    bool found_deferred = false;
+    std::vector<std::string> files = listLogFiles();
+    CHECK(!files.empty());
+    for (const auto &file : files)
+    {
+        for (const auto &line : splitLines(readFile(file)))
+        {
+            bool valid = line.compare(0, 9, "{\"time\":\"") == 0 && line.back() == '}';
+            if (!valid)
+            {
+                fprintf(stderr, "not a JSON record: %s\n", line.substr(0, 200).c_str());
+                ++testFailures();
+                return;
+            }
+            found_marker = found_marker || line.find("\"msg\":\"AsyncLogging dropped ") != std::string::npos;
+            found_deferred = found_deferred || line.find("\"msg\":\"deferred 7 \\\"q\\\"\"") != std::string::npos;
+        }
+    }
+    CHECK(found_marker);
+    CHECK(found_deferred);
+}
+} // namespace
+
+int main()
+{
+    {
+        CapturedLog log;
+        testJsonEscaping(log);
+        testLogfmtEscaping(log);
+    }
+    testAsyncJson();
+    return testResult();
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "logger.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+ * 行为测试的公共部分：每个测试是一个独立的程序，在 CTest 为它准备的目录中运行，
+ * 检查失败时输出位置并继续，main 返回 testResult()
+ */
+
+// 失败的检查数
+inline int &testFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                \
+    do                                                                             \
+    {                                                                              \
+        if (!(cond))                                                               \
+        {                                                                          \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++testFailures();                                                      \
+        }                                                                          \
+    } while (0)
+
+// 整数相等
+#define CHECK_EQ(a, b)                                                                           \
+    do                                                                                           \
+    {                                                                                            \
+        long long va_ = static_cast<long long>(a);                                               \
+        long long vb_ = static_cast<long long>(b);                                               \
+        if (va_ != vb_)                                                                          \
+        {                                                                                        \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, \
+                    #a, #b, va_, vb_);                                                           \
+            ++testFailures();                                                                    \
+        }                                                                                        \
+    } while (0)
+
+// 字符串 s 包含 sub
+#define CHECK_CONTAINS(s, sub)                                                                      \
+    do                                                                                              \
+    {                                                                                               \
+        const std::string vs_(s);                                                                   \
+        if (vs_.find(sub) == std::string::npos)                                                     \
+        {                                                                                           \
+            fprintf(stderr, "%s:%d: \"%s\" not found in: %s\n", __FILE__, __LINE__, sub, vs_.c_str()); \
+            ++testFailures();                                                                       \
+        }                                                                                           \
+    } while (0)
+
+inline int testResult()
+{
+    if (testFailures() > 0)
+    {
+        fprintf(stderr, "%d check(s) failed\n", testFailures());
+        return 1;
+    }
+    return 0;
+}
+
+// 收集同步日志的输出，每条日志一个元素
+class CapturedLog
+{
+public:
+    CapturedLog()
+    {
+        Logger::setOutputFunc([this](const LogStream::Buffer &buf) { lines_.emplace_back(buf.data(), buf.length()); });
+    }
+
+    const std::vector<std::string> &lines() const { return lines_; }
+    const std::string &last() const
+    {
+        static const std::string kEmpty;
+        return lines_.empty() ? kEmpty : lines_.back();
+    }
+    void clear() { lines_.clear(); }
+
+private:
+    std::vector<std::string> lines_;
+};
+
+inline std::string readFile(const std::string &path)
+{
+    std::string data;
+    FILE *file = ::fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return data;
+    }
+    char buf[64 * 1024];
+    size_t n;
+    while ((n = ::fread(buf, 1, sizeof(buf), file)) > 0)
+    {
+        data.append(buf, n);
+    }
+    ::fclose(file);
+    return data;
+}
+
+// 按行拆分，每行不包括换行符
+inline std::vector<std::string> splitLines(const std::string &data)
+{
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < data.size())
+    {
+        size_t end = data.find('\n', start);
+        if (end == std::string::npos)
+        {
+            end = data.size();
+        }
+        lines.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+// log/ 目录中以 suffix 结尾的文件(不包括指向当前文件的符号链接)，按文件名排序
+inline std::vector<std::string> listLogFiles(const char *suffix = ".log")
+{
+    std::vector<std::string> files;
+    DIR *dir = ::opendir("log");
+    if (dir == nullptr)
+    {
+        return files;
+    }
+    size_t suffix_len = strlen(suffix);
+    while (struct dirent *entry = ::readdir(dir))
+    {
+        std::string name(entry->d_name);
+        if (entry->d_type == DT_REG && name.size() >= suffix_len &&
+            name.compare(name.size() - suffix_len, suffix_len, suffix) == 0)
+        {
+            files.push_back("log/" + name);
+        }
+    }
+    ::closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// 删除 log/ 目录中的文件，每个测试从空目录开始
+inline void clearLogDir()
+{
+    DIR *dir = ::opendir("log");
+    if (dir == nullptr)
+    {
+        return;
+    }
+    while (struct dirent *entry = ::readdir(dir))
+    {
+        if (entry->d_type != DT_DIR)
+        {
+            ::remove(("log/" + std::string(entry->d_name)).c_str());
+        }
+    }
+    ::closedir(dir);
+}
@@ -0,0 +1,91 @@
+// 截断标记：超过最大长度的日志末尾注明截断的字节数(JSON 中为 truncated 字段)，飞行记录器中的长日志同样处理，并计入统计
+#include "testutil.h"
+
+#include <stdlib.h>
+
+#include <string>
+
+namespace
+{
+const int kMessageSize = 16000;
+
+// 返回 line 中 marker 之后的数字，没有 marker 时返回 -1
+long long numberAfter(const std::string &line, const char *marker)
+{
+    size_t pos = line.find(marker);
+    return pos == std::string::npos ? -1 : atoll(line.c_str() + pos + strlen(marker));
+}
+
+long long countChar(const std::string &line, char c)
+{
+    return std::count(line.begin(), line.end(), c);
+}
+
+void testText(CapturedLog &log)
+{
+    Logger::setRecordFormat(LogStream::kText);
+    uint64_t messages = Logger::truncatedMessages();
+    uint64_t bytes = Logger::truncatedBytes();
+    LOG_INFO << std::string(kMessageSize, 'z');
+
+    const std::string &line = log.last();
+    long long truncated = numberAfter(line, "z ...(truncated ");
+    CHECK(truncated > 0);
+    CHECK_CONTAINS(line, " bytes)\n");
+    CHECK(line.size() <= 8000);
+    // 保留的部分加上截断的部分正好是整条消息
+    CHECK_EQ(countChar(line, 'z') + truncated, kMessageSize);
+    CHECK_EQ(Logger::truncatedMessages() - messages, 1);
+    CHECK_EQ(Logger::truncatedBytes() - bytes, truncated);
+}
+
+void testJson(CapturedLog &log)
+{
+    Logger::setRecordFormat(LogStream::kJson);
+    LOG_INFO << std::string(kMessageSize, 'z');
+    const std::string &line = log.last();
+    long long truncated = numberAfter(line, "z\",\"truncated\":");
+    CHECK(truncated > 0);
+    CHECK(line.compare(line.size() - 2, 2, "}\n") == 0);
+    CHECK_EQ(countChar(line, 'z') + truncated, kMessageSize);
+    Logger::setRecordFormat(LogStream::kText);
+}
+
+// 飞行记录器每条最多保存 4096 字节，ERROR 输出时先输出截断后的记录
+void testFlightRecorder(CapturedLog &log)
+{
+    Logger::setFlightRecorder(Logger::DEBUG, 64 * 1024, false);
+    uint64_t messages = Logger::truncatedMessages();
+    uint64_t bytes = Logger::truncatedBytes();
+    LOG_DEBUG << std::string(6000, 'z');
+    CHECK_EQ(Logger::truncatedMessages() - messages, 1);
+    long long recorded_truncated = static_cast<long long>(Logger::truncatedBytes() - bytes);
+
+    log.clear();
+    LOG_ERROR << "boom";
+    CHECK_EQ(log.lines().size(), 2);
+    if (log.lines().size() == 2)
+    {
+        const std::string &line = log.lines()[0];
+        long long truncated = numberAfter(line, "z ...(truncated ");
+        CHECK_EQ(truncated, recorded_truncated);
+        CHECK(line.compare(line.size() - 7, 7, "bytes)\n") == 0);
+        CHECK(line.size() < 4096);
+        // 截断的部分包括原来的换行符
+        CHECK_EQ(countChar(line, 'z') + truncated, 6000 + 1);
+        CHECK_CONTAINS(log.lines()[1], " boom\n");
+    }
+    Logger::setFlightRecorder(Logger::NUM_LOG_LEVELS);
+}
+} // namespace
+
+int main()
+{
+    CapturedLog log;
+    Logger::setMaxMessageSize(8000);
+    testText(log);
+    testJson(log);
+    Logger::setMaxMessageSize(1024 * 1024);
+    testFlightRecorder(log);
+    return testResult();
+}
@@ -0,0 +1,222 @@
+// 按时间戳合并多个日志文件，例如分片异步日志的各个分片
+// 文本格式的每条日志以 "YYYY-MM-DD HH:MM:SS.mmm" 开头，不以时间戳开头的行属于上一条日志(多行消息)；
+// JSON 格式的日志以 {"time":"YYYY-...", logfmt 格式的日志以 time="YYYY-..." 开头，每条日志只有一行。
+// 不同格式的文件也可以一起合并。
+// 时间戳相同的日志按输入文件的顺序输出，同一文件内的顺序不变。
+// 支持 gzip 压缩的文件(包括写入时压缩的 .log.gz)
+// 用法: logmerge [-o 输出文件] 文件...
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#ifdef DDLOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+const size_t kTimeLength = 23; // "YYYY-MM-DD HH:MM:SS.mmm"
+
+// line 的 offset 处是否是时间戳
+bool isTimeAt(const std::string &line, size_t offset)
+{
+    static const char kPattern[] = "dddd-dd-dd dd:dd:dd.ddd";
+    if (line.size() < offset + kTimeLength)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < kTimeLength; ++i)
+    {
+        char c = line[offset + i];
+        if (kPattern[i] == 'd' ? (c < '0' || c > '9') : c != kPattern[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 一行是否是一条日志的开始，是时返回时间戳的位置，否则返回 std::string::npos
+size_t timeOffset(const std::string &line)
+{
+    // 文本、JSON 和 logfmt 格式中时间戳之前的内容
+    static const char *kPrefixes[] = {"", "{\"time\":\"", "time=\""};
+    for (const char *prefix : kPrefixes)
+    {
+        size_t len = strlen(prefix);
+        if (line.compare(0, len, prefix) == 0 && isTimeAt(line, len))
+        {
+            return len;
+        }
+    }
+    return std::string::npos;
+}
+
+// 一个输入文件：按条读取日志
+class Input
+{
+public:
+    explicit Input(const char *file_name)
+    {
+#ifdef DDLOG_HAVE_ZLIB
+        // gzopen 也可以读取未压缩的文件
+        file_ = ::gzopen(file_name, "rb");
+#else
+        file_ = ::fopen(file_name, "rb");
+#endif
+        if (file_)
+        {
+            readLine();
+        }
+    }
+    ~Input()
+    {
+        if (file_)
+        {
+#ifdef DDLOG_HAVE_ZLIB
+            ::gzclose(file_);
+#else
+            ::fclose(file_);
+#endif
+        }
+    }
+
+    bool ok() const { return file_ != nullptr; }
+
+    // 读取下一条日志(包括之后不以时间戳开头的行)和其中时间戳的位置，没有时返回 false
+    bool next(std::string *record, size_t *time_offset)
+    {
+        if (!has_line_)
+        {
+            return false;
+        }
+        record->swap(line_);
+        // 文件开头不是一条日志时按时间戳为空处理
+        *time_offset = timeOffset(*record);
+        if (*time_offset == std::string::npos)
+        {
+            *time_offset = record->size();
+        }
+        while (readLine() && timeOffset(line_) == std::string::npos)
+        {
+            record->append(line_);
+        }
+        return true;
+    }
+
+private:
+    // 读取一行(包括换行符)到 line_
+    bool readLine()
+    {
+        line_.clear();
+        char buf[4096];
+        for (;;)
+        {
+#ifdef DDLOG_HAVE_ZLIB
+            char *p = ::gzgets(file_, buf, sizeof(buf));
+#else
+            char *p = ::fgets(buf, sizeof(buf), file_);
+#endif
+            if (p == nullptr)
+            {
+                break;
+            }
+            line_.append(buf);
+            if (!line_.empty() && line_.back() == '\n')
+            {
+                break;
+            }
+        }
+        has_line_ = !line_.empty();
+        return has_line_;
+    }
+
+#ifdef DDLOG_HAVE_ZLIB
+    gzFile file_ = nullptr;
+#else
+    FILE *file_ = nullptr;
+#endif
+    std::string line_;
+    bool has_line_ = false;
+};
+
+// 堆中的一项：每个输入文件当前的一条日志
+struct Head
+{
+    std::string record;
+    size_t time_offset; // 时间戳在 record 中的位置
+    size_t input;
+};
+
+// 时间戳小的在前，相同时按输入文件的顺序
+struct Later
+{
+    bool operator()(const Head &a, const Head &b) const
+    {
+        int cmp = a.record.compare(a.time_offset, kTimeLength, b.record, b.time_offset, kTimeLength);
+        return cmp != 0 ? cmp > 0 : a.input > b.input;
+    }
+};
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    FILE *out = stdout;
+    std::vector<std::unique_ptr<Input>> inputs;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            out = ::fopen(argv[++i], "w");
+            if (out == nullptr)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        std::unique_ptr<Input> input(new Input(argv[i]));
+        if (!input->ok())
+        {
+            fprintf(stderr, "logmerge: cannot open %s\n", argv[i]);
+            return 1;
+        }
+        inputs.push_back(std::move(input));
+    }
+    if (inputs.empty())
+    {
+        fprintf(stderr, "usage: %s [-o output] file...\n", argv[0]);
+        return 1;
+    }
+
+    std::priority_queue<Head, std::vector<Head>, Later> heap;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        Head head{std::string(), 0, i};
+        if (inputs[i]->next(&head.record, &head.time_offset))
+        {
+            heap.push(std::move(head));
+        }
+    }
+    // 多路归并
+    while (!heap.empty())
+    {
+        Head head = heap.top();
+        heap.pop();
+        ::fwrite(head.record.data(), 1, head.record.size(), out);
+        if (inputs[head.input]->next(&head.record, &head.time_offset))
+        {
+            heap.push(std::move(head));
+        }
+    }
+    if (out != stdout)
+    {
+        ::fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+// 取出异步日志缓冲区文件(log/<程序名>.buf，LogFileOptions::crash_safe)中还没有写入日志文件的内容
+// 进程被 SIGKILL 等无法处理的信号终止后，缓冲区中的日志仍然保存在这个文件里
+// 用法: logrecover [-c] [-o 输出文件] 缓冲区文件
+//   -c: 取出后清零，下次启动时不再重复写入日志(文件正在被使用时不清零)
+#include "bufferarena.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+int main(int argc, char *argv[])
+{
+    bool clear = false;
+    const char *output = nullptr;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-c") == 0)
+        {
+            clear = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else
+        {
+            path = argv[i];
+        }
+    }
+    if (path == nullptr)
+    {
+        fprintf(stderr, "usage: %s [-c] [-o output] file.buf\n", argv[0]);
+        return 1;
+    }
+
+    std::string data;
+    pid_t pid = 0;
+    bool ok = BufferArena::recoverFile(path, &data, &pid, clear);
+    if (!ok && data.empty())
+    {
+        fprintf(stderr, "logrecover: %s is not a log buffer file or is in use\n", path);
+        return 1;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "logrecover: %s is in use, not cleared\n", path);
+    }
+
+    FILE *out = output ? ::fopen(output, "w") : stdout;
+    if (out == nullptr)
+    {
+        perror(output);
+        return 1;
+    }
+    ::fwrite(data.data(), 1, data.size(), out);
+    if (out != stdout)
+    {
+        ::fclose(out);
+    }
+    fprintf(stderr, "logrecover: %zu bytes from process %d\n", data.size(), static_cast<int>(pid));
+    return 0;
+}